@@ -0,0 +1,397 @@
+/*
+ * Operating Systems (2INCO) Practical Assignment
+ * Interprocess Communication
+ *
+ * Zachary Kohnen (1655221)
+ *
+ * Benchmark of the farmer and the workers. Runs ./farmer once for every
+ * combination of the given parameters, searching for hashes of random
+ * messages streamed from a file, with the random delay of the workers turned
+ * off. Prints one line of comma separated values for every run.
+ *
+ * usage: benchmark [-m] [-s] [-r runs] [-w workers] [-d depths]
+ *                  [-c alphabet sizes] [-l lengths] [-t target counts]
+ *
+ * Every parameter takes a comma separated list of values.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "md5s.h"
+// Only the constants of settings.h are needed, not the hashes it defines
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#include "settings.h" // definition of work
+#pragma GCC diagnostic pop
+
+// The most values a parameter can be given
+#define MAX_VALUES 32
+
+// The parameters every run is made with
+typedef struct {
+    long workers;
+    long depth; // The depth of the queues
+    long alphabet_length;
+    long max_length;
+    long targets; // The amount of hashes to search for
+} benchmark_run_t;
+
+// What a run measured
+typedef struct {
+    double wall_seconds;
+    double farmer_cpu_seconds;
+    double first_match_ms; // -1 if no hash was solved
+    uint64_t candidates; // The amount of messages the workers hashed
+} benchmark_result_t;
+
+/**
+ * @brief Parse a comma separated list of positive numbers
+ *
+ * @return The amount of numbers, or 0 if the list is not valid
+ */
+static int parse_values(const char *list, long values[MAX_VALUES]) {
+    int count = 0;
+
+    while (count < MAX_VALUES) {
+        char *end;
+        values[count] = strtol(list, &end, 10);
+
+        if (end == list || values[count] < 1) {
+            return 0;
+        }
+
+        count++;
+
+        if (*end == '\0') {
+            return count;
+        }
+
+        if (*end != ',') {
+            return 0;
+        }
+
+        list = end + 1;
+    }
+
+    return 0;
+}
+
+static double monotonic_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Write the hashes of random messages of the keyspace of the run, one
+ * per line, so that every hash can be solved. The same seed gives the same
+ * messages.
+ *
+ * @return false if the file could not be written
+ */
+static bool write_targets(const char *path, const benchmark_run_t *run,
+                          unsigned int seed) {
+    FILE *file = fopen(path, "w");
+
+    if (file == NULL) {
+        return false;
+    }
+
+    srandom(seed);
+
+    for (long i = 0; i < run->targets; i++) {
+        char message[MESSAGE_LENGTH_LIMIT];
+        int length = 1 + random() % run->max_length;
+
+        for (int j = 0; j < length; j++) {
+            message[j] = ALPHABET_START_CHAR + random() % run->alphabet_length;
+        }
+
+        uint128_t hash = md5s(message, length);
+        fprintf(file, "%016lx%016lx\n", HI(hash), LO(hash));
+    }
+
+    return fclose(file) == 0;
+}
+
+/**
+ * @brief Read the farmer CPU time, the time to the first match and the
+ * amount of hashed messages from a snapshot of the stats board
+ *
+ * @return false if the snapshot could not be read
+ */
+static bool read_snapshot(const char *path, benchmark_result_t *result) {
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL) {
+        return false;
+    }
+
+    char line[512];
+    bool header = true;
+    result->candidates = 0;
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] == '#') {
+            sscanf(line, "# farmer_cpu_seconds %lf",
+                   &result->farmer_cpu_seconds);
+            sscanf(line, "# first_match_ms %lf", &result->first_match_ms);
+            continue;
+        }
+
+        // The line naming the columns
+        if (header) {
+            header = false;
+            continue;
+        }
+
+        // worker, pid, node, cpu, candidates, ...
+        uint64_t candidates;
+        if (sscanf(line, "%*d %*d %*d %*d %lu", &candidates) == 1) {
+            result->candidates += candidates;
+        }
+    }
+
+    fclose(file);
+
+    return !header;
+}
+
+/**
+ * @brief Run the farmer once with the parameters of the run, without its
+ * output
+ *
+ * @return false if the farmer could not be run or failed
+ */
+static bool run_farmer(const benchmark_run_t *run, bool multi_target,
+                       bool shared_memory, const char *targets_path,
+                       const char *snapshot_path, benchmark_result_t *result) {
+    char pool[64], depth[32], alphabet_length[32], max_length[32];
+    snprintf(pool, sizeof(pool), "%ld:%ld", run->workers, run->workers);
+    snprintf(depth, sizeof(depth), "%ld", run->depth);
+    snprintf(alphabet_length, sizeof(alphabet_length), "%ld",
+             run->alphabet_length);
+    snprintf(max_length, sizeof(max_length), "%ld", run->max_length);
+
+    char *arguments[32];
+    size_t argument_count = 0;
+
+    arguments[argument_count++] = "farmer";
+    arguments[argument_count++] = "-R";
+    arguments[argument_count++] = "-f";
+    arguments[argument_count++] = (char *)targets_path;
+    arguments[argument_count++] = "-o";
+    arguments[argument_count++] = (char *)snapshot_path;
+    arguments[argument_count++] = "-e";
+    arguments[argument_count++] = pool;
+    arguments[argument_count++] = "-d";
+    arguments[argument_count++] = depth;
+    arguments[argument_count++] = "-c";
+    arguments[argument_count++] = alphabet_length;
+    arguments[argument_count++] = "-l";
+    arguments[argument_count++] = max_length;
+
+    if (multi_target) {
+        arguments[argument_count++] = "-m";
+    }
+
+    if (shared_memory) {
+        arguments[argument_count++] = "-s";
+    }
+
+    arguments[argument_count++] = NULL;
+
+    double started = monotonic_seconds();
+    pid_t farmer = fork();
+
+    if (farmer < 0) {
+        perror("fork() failed");
+        return false;
+    }
+
+    if (farmer == 0) {
+        // Printing the matches and the log would only slow the run down
+        int null = open("/dev/null", O_WRONLY);
+
+        if (null != -1) {
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+            close(null);
+        }
+
+        execvp("./farmer", arguments);
+
+        // we should never arrive here...
+        _exit(127);
+    }
+
+    int status;
+    if (waitpid(farmer, &status, 0) == -1) {
+        perror("Failed to wait for the farmer");
+        return false;
+    }
+
+    result->wall_seconds = monotonic_seconds() - started;
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "benchmark: The farmer failed with status %d\n",
+                status);
+        return false;
+    }
+
+    if (!read_snapshot(snapshot_path, result)) {
+        fprintf(stderr, "Failed to read %s: %s\n", snapshot_path,
+                strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    bool multi_target = false;
+    bool shared_memory = false;
+    long runs = 1;
+
+    long workers[MAX_VALUES] = { NROF_WORKERS };
+    long depths[MAX_VALUES] = { MQ_MAX_MESSAGES };
+    long alphabet_lengths[MAX_VALUES] = { ALPHABET_LENGTH };
+    long max_lengths[MAX_VALUES] = { MAX_MESSAGE_LENGTH };
+    long targets[MAX_VALUES] = { 1 };
+    int worker_count = 1, depth_count = 1, alphabet_count = 1;
+    int length_count = 1, target_count = 1;
+
+    int option;
+    while ((option = getopt(argc, argv, "msr:w:d:c:l:t:")) != -1) {
+        bool valid = true;
+
+        switch (option) {
+            case 'm':
+                multi_target = true;
+                break;
+            case 's':
+                shared_memory = true;
+                break;
+            case 'r':
+                runs = strtol(optarg, NULL, 10);
+                valid = runs > 0;
+                break;
+            case 'w':
+                valid = (worker_count = parse_values(optarg, workers)) > 0;
+                break;
+            case 'd':
+                valid = (depth_count = parse_values(optarg, depths)) > 0;
+                break;
+            case 'c':
+                alphabet_count = parse_values(optarg, alphabet_lengths);
+                valid = alphabet_count > 0;
+
+                for (int i = 0; i < alphabet_count; i++) {
+                    valid &= alphabet_lengths[i] <= ALPHABET_LENGTH;
+                }
+                break;
+            case 'l':
+                length_count = parse_values(optarg, max_lengths);
+                valid = length_count > 0;
+
+                for (int i = 0; i < length_count; i++) {
+                    valid &= max_lengths[i] <= MESSAGE_LENGTH_LIMIT;
+                }
+                break;
+            case 't':
+                valid = (target_count = parse_values(optarg, targets)) > 0;
+                break;
+            default:
+                valid = false;
+                break;
+        }
+
+        if (!valid) {
+            fprintf(stderr,
+                    "usage: %s [-m] [-s] [-r runs] [-w workers] [-d depths] "
+                    "[-c alphabet sizes] [-l lengths] [-t target counts]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    char targets_path[] = "/tmp/benchmark_targets_XXXXXX";
+    char snapshot_path[] = "/tmp/benchmark_snapshot_XXXXXX";
+    int targets_fd = mkstemp(targets_path);
+    int snapshot_fd = mkstemp(snapshot_path);
+
+    if (targets_fd == -1 || snapshot_fd == -1) {
+        perror("Failed to create the temporary files");
+        return 1;
+    }
+
+    close(targets_fd);
+    close(snapshot_fd);
+
+    printf("workers,depth,alphabet,length,targets,run,wall_s,farmer_cpu_s,"
+           "first_match_ms,candidates,hashes_per_s\n");
+    fflush(stdout);
+
+    int status = 0;
+
+    // Every combination of the parameters, the targets changing fastest
+    long points = (long)worker_count * depth_count * alphabet_count *
+                  length_count * target_count;
+
+    for (long point = 0; point < points; point++) {
+        long rest = point;
+        benchmark_run_t run;
+
+        run.targets = targets[rest % target_count];
+        rest /= target_count;
+        run.max_length = max_lengths[rest % length_count];
+        rest /= length_count;
+        run.alphabet_length = alphabet_lengths[rest % alphabet_count];
+        rest /= alphabet_count;
+        run.depth = depths[rest % depth_count];
+        rest /= depth_count;
+        run.workers = workers[rest];
+
+        for (long r = 0; r < runs; r++) {
+            benchmark_result_t result = { .first_match_ms = -1 };
+
+            if (!write_targets(targets_path, &run, r + 1)) {
+                fprintf(stderr, "Failed to write %s: %s\n", targets_path,
+                        strerror(errno));
+                status = 1;
+                break;
+            }
+
+            if (!run_farmer(&run, multi_target, shared_memory, targets_path,
+                            snapshot_path, &result)) {
+                status = 1;
+                continue;
+            }
+
+            printf("%ld,%ld,%ld,%ld,%ld,%ld,%.6f,%.6f,%.3f,%lu,%.0f\n",
+                   run.workers, run.depth, run.alphabet_length,
+                   run.max_length, run.targets, r, result.wall_seconds,
+                   result.farmer_cpu_seconds, result.first_match_ms,
+                   result.candidates, result.candidates / result.wall_seconds);
+            fflush(stdout);
+        }
+    }
+
+    unlink(targets_path);
+    unlink(snapshot_path);
+
+    return status;
+}
@@ -0,0 +1,373 @@
+/*
+ * Operating Systems (2INCO) Practical Assignment
+ * Interprocess Communication
+ *
+ * Zachary Kohnen (1655221)
+ *
+ * Candidate generator which enumerates the keyspace of a job and writes the
+ * candidates straight into md5_batch_t batches for the hash kernels
+ *
+ */
+
+#ifndef CANDIDATES_H_
+#define CANDIDATES_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "md5_kernel.h"
+
+typedef struct candidates candidates_t;
+
+// Fills a batch with candidates of the current length, see
+// candidates_fill_batch()
+typedef bool (*candidates_fill_fn)(candidates_t *candidates,
+                                   md5_batch_t *batch);
+
+/**
+ * @brief Enumerates every message made of a fixed prefix followed by chars in
+ * alphabet_start..alphabet_stop, for all lengths from the prefix length up to
+ * max_length. Shorter messages come first and messages of the same length are
+ * in lexicographic order, so the last char changes the fastest.
+ *
+ * The current candidate is kept as a padded MD5 block so that emitting it into
+ * a batch only copies the words that hold message chars.
+ */
+struct candidates {
+    uint8_t block[64]; // The current candidate, padded as an MD5 block
+    int prefix_length; // The amount of chars fixed at the start of a message
+    int length; // The length of the current candidate
+    int max_length; // The length of the longest candidate
+    char alphabet_start;
+    char alphabet_stop;
+    uint64_t remaining; // The amount of candidates left to emit
+    bool done; // Set once every candidate has been emitted
+
+    candidates_fill_fn fill; // The generator for fill_length
+    int fill_length; // The length fill was picked for, 0 if none yet
+};
+
+/**
+ * @brief The amount of messages made of a prefix of the given length followed
+ * by chars of the alphabet, which are at most max_length chars long and not
+ * empty
+ *
+ * @return The amount, or UINT64_MAX if it does not fit in 64 bits
+ */
+static inline uint64_t candidates_count(int prefix_length, int alphabet_length,
+                                        int max_length) {
+    uint64_t count = 0;
+    uint64_t length_count = 1;
+
+    for (int length = prefix_length; length <= max_length; length++) {
+        if (length > 0 &&
+            __builtin_add_overflow(count, length_count, &count)) {
+            return UINT64_MAX;
+        }
+
+        if (length < max_length &&
+            __builtin_mul_overflow(length_count, (uint64_t)alphabet_length,
+                                   &length_count)) {
+            return UINT64_MAX;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * @brief Reset the block to the first candidate of the given length
+ */
+static inline void candidates_start_length(candidates_t *candidates,
+                                           int length) {
+    uint8_t *block = candidates->block;
+
+    memset(&block[candidates->prefix_length], 0,
+           sizeof(candidates->block) - candidates->prefix_length);
+    memset(&block[candidates->prefix_length], candidates->alphabet_start,
+           length - candidates->prefix_length);
+    block[length] = 0x80;
+
+    uint32_t bit_length = (uint32_t)length * 8;
+    memcpy(&block[56], &bit_length, sizeof(bit_length));
+
+    candidates->length = length;
+}
+
+/**
+ * @brief Start enumerating the keyspace of a job
+ *
+ * @param prefix The chars every candidate starts with
+ * @param prefix_length The amount of chars in prefix, may be 0
+ * @param max_length The length of the longest candidate, at most
+ * MD5_BLOCK_MAX_MESSAGE
+ */
+static inline void candidates_init(candidates_t *candidates, const char *prefix,
+                                   int prefix_length, char alphabet_start,
+                                   char alphabet_stop, int max_length) {
+    memcpy(candidates->block, prefix, prefix_length);
+    candidates->prefix_length = prefix_length;
+    candidates->max_length = max_length;
+    candidates->alphabet_start = alphabet_start;
+    candidates->alphabet_stop = alphabet_stop;
+    candidates->remaining = UINT64_MAX;
+    candidates->fill_length = 0;
+
+    // The empty message is not a candidate
+    int first_length = prefix_length > 0 ? prefix_length : 1;
+
+    candidates->done = first_length > max_length;
+    if (!candidates->done) {
+        candidates_start_length(candidates, first_length);
+    }
+}
+
+/**
+ * @brief Jump to the candidate with the given index and only emit count
+ * candidates from there on. Candidates are numbered in the order they are
+ * emitted, starting at 0.
+ */
+static inline void candidates_seek(candidates_t *candidates, uint64_t index,
+                                   uint64_t count) {
+    int alphabet_length = candidates->alphabet_stop -
+                          candidates->alphabet_start + 1;
+    int length = candidates->prefix_length > 0 ? candidates->prefix_length : 1;
+
+    // Skip over the lengths before the one the candidate has
+    uint64_t length_count = 1;
+    for (int i = candidates->prefix_length; i < length; i++) {
+        length_count *= alphabet_length;
+    }
+
+    while (length <= candidates->max_length && index >= length_count) {
+        index -= length_count;
+        length_count *= alphabet_length;
+        length++;
+    }
+
+    candidates->remaining = count;
+    candidates->done = length > candidates->max_length || count == 0;
+
+    if (candidates->done) {
+        return;
+    }
+
+    candidates_start_length(candidates, length);
+
+    // The index within the length is the candidate written in base
+    // alphabet_length
+    for (int position = length - 1; position >= candidates->prefix_length;
+         position--) {
+        candidates->block[position] = candidates->alphabet_start +
+                                      index % alphabet_length;
+        index /= alphabet_length;
+    }
+}
+
+/**
+ * @brief Carry into the chars before the last one once the last char wrapped
+ * around. The message grows once every char has wrapped around.
+ *
+ * @return false if the length changed or the keyspace is exhausted
+ */
+static inline bool candidates_carry(candidates_t *candidates) {
+    uint8_t *block = candidates->block;
+
+    for (int position = candidates->length - 2;
+         position >= candidates->prefix_length; position--) {
+        if (block[position] < (uint8_t)candidates->alphabet_stop) {
+            block[position]++;
+            return true;
+        }
+
+        block[position] = candidates->alphabet_start;
+    }
+
+    if (candidates->length == candidates->max_length) {
+        candidates->done = true;
+    } else {
+        candidates_start_length(candidates, candidates->length + 1);
+    }
+
+    return false;
+}
+
+/**
+ * @brief Fill the batch with the next candidates, which must be of the given
+ * length. Candidates only differ in their last char until it wraps around,
+ * so the batch is filled a run of such candidates at a time by adding the
+ * lane to the word holding the last char. The specialised generators call
+ * this with a constant alphabet and length, so that the runs are unrolled and
+ * the word and shift of the last char fold away.
+ */
+static inline __attribute__((always_inline)) bool
+candidates_fill_batch(candidates_t *candidates, md5_batch_t *batch,
+                      const uint8_t alphabet_start, const uint8_t alphabet_stop,
+                      const int length) {
+    uint8_t *block = candidates->block;
+
+    // Words past the last message char only change with the length
+    const int first_fixed_word = (length - 1) / 4 + 1;
+    if (batch->length != length) {
+        for (int w = first_fixed_word; w < 16; w++) {
+            uint32_t word;
+            memcpy(&word, &block[w * 4], sizeof(word));
+
+            for (int lane = 0; lane < MD5_BATCH_LANES; lane++) {
+                batch->words[w][lane] = word;
+            }
+        }
+
+        batch->length = length;
+    }
+
+    const int last_word = (length - 1) / 4;
+    const int last_shift = 8 * ((length - 1) % 4);
+
+    // A message made of only the prefix is the one candidate of its length
+    bool prefix_only = length == candidates->prefix_length;
+
+    int lanes = candidates->remaining < MD5_BATCH_LANES
+                    ? (int)candidates->remaining
+                    : MD5_BATCH_LANES;
+    int count = 0;
+
+    while (count < lanes) {
+        uint8_t last = block[length - 1];
+        int run = prefix_only ? 1 : alphabet_stop - last + 1;
+
+        if (run > lanes - count) {
+            run = lanes - count;
+        }
+
+        uint32_t words[16];
+        memcpy(words, block, sizeof(uint32_t) * first_fixed_word);
+
+        for (int i = 0; i < run; i++) {
+            for (int w = 0; w < first_fixed_word; w++) {
+                batch->words[w][count + i] =
+                    w == last_word ? words[w] + ((uint32_t)i << last_shift)
+                                   : words[w];
+            }
+        }
+
+        count += run;
+
+        if (!prefix_only && last + run <= alphabet_stop) {
+            block[length - 1] = (uint8_t)(last + run);
+            continue;
+        }
+
+        if (!prefix_only) {
+            block[length - 1] = alphabet_start;
+        }
+
+        // All candidates in a batch have the same length
+        if (!candidates_carry(candidates)) {
+            break;
+        }
+    }
+
+    batch->count = count;
+    candidates->remaining -= count;
+
+    if (candidates->remaining == 0) {
+        candidates->done = true;
+    }
+
+    return true;
+}
+
+static bool candidates_fill_generic(candidates_t *candidates,
+                                    md5_batch_t *batch) {
+    return candidates_fill_batch(candidates, batch,
+                                 (uint8_t)candidates->alphabet_start,
+                                 (uint8_t)candidates->alphabet_stop,
+                                 candidates->length);
+}
+
+// The alphabets that get specialised generators, as X(name, start, stop)
+#define CANDIDATES_ALPHABETS(X) \
+    X(lower, 'a', 'z')          \
+    X(upper, 'A', 'Z')          \
+    X(digits, '0', '9')
+
+// The lengths that get specialised generators for every alphabet
+#define CANDIDATES_SPECIALISED_LENGTHS 8
+
+#define CANDIDATES_FILL_FUNCTION(name, start, stop, length)              \
+    static bool candidates_fill_##name##_##length(candidates_t *candidates, \
+                                                  md5_batch_t *batch) {     \
+        return candidates_fill_batch(candidates, batch, start, stop, length); \
+    }
+
+#define CANDIDATES_FILL_FUNCTIONS(name, start, stop) \
+    CANDIDATES_FILL_FUNCTION(name, start, stop, 1)   \
+    CANDIDATES_FILL_FUNCTION(name, start, stop, 2)   \
+    CANDIDATES_FILL_FUNCTION(name, start, stop, 3)   \
+    CANDIDATES_FILL_FUNCTION(name, start, stop, 4)   \
+    CANDIDATES_FILL_FUNCTION(name, start, stop, 5)   \
+    CANDIDATES_FILL_FUNCTION(name, start, stop, 6)   \
+    CANDIDATES_FILL_FUNCTION(name, start, stop, 7)   \
+    CANDIDATES_FILL_FUNCTION(name, start, stop, 8)
+
+CANDIDATES_ALPHABETS(CANDIDATES_FILL_FUNCTIONS)
+
+#define CANDIDATES_SELECT(name, start, stop)                          \
+    if (candidates->alphabet_start == (start) &&                      \
+        candidates->alphabet_stop == (stop)) {                        \
+        candidates_fill_fn fills[CANDIDATES_SPECIALISED_LENGTHS] = {  \
+            candidates_fill_##name##_1, candidates_fill_##name##_2,   \
+            candidates_fill_##name##_3, candidates_fill_##name##_4,   \
+            candidates_fill_##name##_5, candidates_fill_##name##_6,   \
+            candidates_fill_##name##_7, candidates_fill_##name##_8,   \
+        };                                                            \
+        return fills[length - 1];                                     \
+    }
+
+/**
+ * @brief Pick the generator for the candidates of the current length, a
+ * specialised one if there is one for the alphabet and length
+ */
+static inline candidates_fill_fn candidates_select(const candidates_t
+                                                       *candidates) {
+    int length = candidates->length;
+
+    if (length <= CANDIDATES_SPECIALISED_LENGTHS) {
+        CANDIDATES_ALPHABETS(CANDIDATES_SELECT)
+    }
+
+    return candidates_fill_generic;
+}
+
+#undef CANDIDATES_FILL_FUNCTION
+#undef CANDIDATES_FILL_FUNCTIONS
+#undef CANDIDATES_SELECT
+
+/**
+ * @brief Fill the batch with the next candidates. All candidates in a batch
+ * have the same length, so a batch is cut short when the length changes.
+ *
+ * The batch must be zero initialized before the first call and must not be
+ * modified by anything else in between calls.
+ *
+ * @return false once the keyspace is exhausted and the batch is empty
+ */
+static inline bool candidates_next_batch(candidates_t *candidates,
+                                         md5_batch_t *batch) {
+    batch->count = 0;
+
+    if (candidates->done) {
+        return false;
+    }
+
+    if (candidates->fill_length != candidates->length) {
+        candidates->fill = candidates_select(candidates);
+        candidates->fill_length = candidates->length;
+    }
+
+    return candidates->fill(candidates, batch);
+}
+
+#endif // CANDIDATES_H_
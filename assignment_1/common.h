@@ -11,22 +11,75 @@
 #ifndef COMMON_H_
 #define COMMON_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "uint128.h"
 
-// Maximum size for any message in the tests
+// Maximum size for any message in the tests, used unless the farmer is told
+// another length
 #define MAX_MESSAGE_LENGTH 6
 
+// The longest messages that can be searched for, which sizes the messages
+// exchanged with the workers
+#define MESSAGE_LENGTH_LIMIT 16
+
+/**
+ * @brief A range of the keyspace: the messages starting with prefix, numbered
+ * in the order of the candidate generator, from start up to but not including
+ * end
+ */
 typedef struct {
-    char starting_char; // The first char of the message to search for
+    char prefix[MESSAGE_LENGTH_LIMIT]; // The chars every message starts with
+    int prefix_length; // The amount of chars in prefix, may be 0
+    int max_length; // The length of the longest message to search
+    uint64_t start; // The index of the first message to search
+    uint64_t end; // One past the index of the last message to search
     char alphabet_start; // The min char value that could be in the message
     char alphabet_stop; // The max char value that could be in the message
     uint128_t hash; // The hash to compare against
     int hash_id; // A unique ID of the hash to identify responses
+    bool all_targets; // Check every hash in the target list instead of hash
+    bool shutdown; // Tells the worker to exit instead
 } job_t;
 
 typedef struct {
-    char match[MAX_MESSAGE_LENGTH + 1]; // The message that matches the hash
+    char match[MESSAGE_LENGTH_LIMIT + 1]; // The matching message, ended by a
+                                          // null char
     int hash_id; // The ID of the hash that was matched against
+    bool done; // Reports a finished job instead of a match
+    uint64_t candidates; // The amount of candidates the finished job hashed
+    uint64_t nanoseconds; // The time it took to hash them, 0 if cancelled
+    uint64_t covered; // The amount of candidates the job was responsible
+                      // for, which is less than its range if it got stolen
 } response_t;
 
+// The most jobs or responses packed into a single message
+#define JOB_BATCH_MAX 16
+#define RESPONSE_BATCH_MAX 32
+
+typedef struct {
+    int count; // The amount of jobs in use
+    job_t jobs[JOB_BATCH_MAX];
+} job_batch_t;
+
+typedef struct {
+    int count; // The amount of responses in use
+    response_t responses[RESPONSE_BATCH_MAX];
+} response_batch_t;
+
+/**
+ * @brief The amount of jobs or responses to pack into one message, so that a
+ * queue holding depth messages holds about in_flight jobs or responses
+ */
+static inline int batch_size(long depth, long in_flight, int max) {
+    long size = (in_flight + depth - 1) / depth;
+
+    if (size < 1) {
+        return 1;
+    }
+
+    return size > max ? max : (int)size;
+}
+
 #endif // COMMON_H_
@@ -0,0 +1,188 @@
+/*
+ * Operating Systems (2INCO) Practical Assignment
+ * Interprocess Communication
+ *
+ * Zachary Kohnen (1655221)
+ *
+ * The precomputed digest index: every message of a keyspace, sorted by the
+ * first MD5 state word of its digest. The file is written by index_builder
+ * and mapped by the farmer, which looks the hashes up instead of searching.
+ *
+ */
+
+#ifndef DIGEST_INDEX_H_
+#define DIGEST_INDEX_H_
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "candidates.h"
+#include "md5_kernel.h"
+#include "md5s.h"
+#include "uint128.h"
+
+#define DIGEST_INDEX_MAGIC "MD5IDX01"
+
+// The header at the start of the file, the entries follow right after it
+typedef struct {
+    char magic[8]; // DIGEST_INDEX_MAGIC
+    uint32_t layout; // The md5_layout_t the keys were computed with
+    char alphabet_start;
+    char alphabet_stop;
+    int32_t max_length;
+    uint64_t count; // The amount of entries
+} digest_index_header_t;
+
+/**
+ * @brief An entry of the index. Only 32 bits of the digest are kept, so a key
+ * can match more than one message and every match is checked with md5s().
+ */
+typedef struct {
+    uint32_t key; // The first MD5 state word of the digest
+    uint32_t message; // The index of the message in generator order
+} digest_index_entry_t;
+
+typedef struct {
+    const digest_index_header_t *header;
+    const digest_index_entry_t *entries;
+    size_t size; // Size of the mapping
+} digest_index_t;
+
+/**
+ * @brief Map an index file and check that it can be used by this program
+ *
+ * @return false with errno set if the file could not be mapped, or with
+ * errno set to EINVAL if it is not a valid index
+ */
+static inline bool digest_index_open(digest_index_t *index, const char *path) {
+    int fd = open(path, O_RDONLY);
+
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) == -1) {
+        close(fd);
+        return false;
+    }
+
+    if ((size_t)status.st_size < sizeof(digest_index_header_t)) {
+        close(fd);
+        errno = EINVAL;
+        return false;
+    }
+
+    void *mapping = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    index->header = mapping;
+    index->entries = (const digest_index_entry_t *)(index->header + 1);
+    index->size = status.st_size;
+
+    // The keys only mean the same thing when md5s() packs digests the same
+    // way as when the index was built
+    md5_layout = md5_detect_layout();
+
+    if (memcmp(index->header->magic, DIGEST_INDEX_MAGIC,
+               sizeof(index->header->magic)) != 0 ||
+        index->header->layout != md5_layout ||
+        index->size != sizeof(digest_index_header_t) +
+                       sizeof(digest_index_entry_t) * index->header->count) {
+        munmap(mapping, index->size);
+        errno = EINVAL;
+        return false;
+    }
+
+    // Lookups jump all over the file
+    madvise(mapping, index->size, MADV_RANDOM);
+
+    return true;
+}
+
+static inline void digest_index_close(digest_index_t *index) {
+    munmap((void *)index->header, index->size);
+}
+
+/**
+ * @brief Find the first entry with a key of at least key. The keys are
+ * uniformly distributed, so the position is interpolated from the key and
+ * only the few entries around the guess are searched.
+ */
+static inline uint64_t digest_index_find(const digest_index_t *index,
+                                         uint32_t key) {
+    const digest_index_entry_t *entries = index->entries;
+    uint64_t count = index->header->count;
+
+    uint64_t guess = (uint64_t)(((unsigned __int128)key * count) >> 32);
+
+    // Widen a bracket around the guess until it holds the first entry with
+    // the key, then binary search in it
+    uint64_t low = guess;
+    uint64_t high = guess;
+    uint64_t step = 16;
+
+    while (low > 0 && entries[low - 1].key >= key) {
+        low = low > step ? low - step : 0;
+        step *= 2;
+    }
+
+    step = 16;
+    while (high < count && entries[high].key < key) {
+        high = count - high > step ? high + step : count;
+        step *= 2;
+    }
+
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+
+        if (entries[middle].key < key) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+/**
+ * @brief Look a hash up in the index
+ *
+ * @param message Receives the message with the hash, must have space for
+ * max_length + 1 chars of the index
+ * @return false if no message in the index has the hash
+ */
+static inline bool digest_index_lookup(const digest_index_t *index,
+                                       uint128_t hash, char *message) {
+    const digest_index_header_t *header = index->header;
+    uint32_t key = md5_target(hash).state[0];
+
+    for (uint64_t i = digest_index_find(index, key);
+         i < header->count && index->entries[i].key == key; i++) {
+        candidates_t candidates;
+        candidates_init(&candidates, "", 0, header->alphabet_start,
+                        header->alphabet_stop, header->max_length);
+        candidates_seek(&candidates, index->entries[i].message, 1);
+
+        memcpy(message, candidates.block, candidates.length);
+        message[candidates.length] = '\0';
+
+        if (md5s(message, candidates.length) == hash) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#endif // DIGEST_INDEX_H_
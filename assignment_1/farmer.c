@@ -12,30 +12,1270 @@
  * - Report quality
  */
 
+#include <ctype.h>
 #include <errno.h>
-#include <mqueue.h> // for mq
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h> // for execlp
 
+#include "candidates.h"
 #include "common.h"
+#include "digest_index.h"
+#include "queue.h"
+#include "ranges.h"
 #include "settings.h" // definition of work
+#include "stats.h"
+#include "targets.h"
+#include "topology.h"
+
+// How long a job should keep a worker busy, long enough to make the random
+// delay of every job and the queue traffic negligible
+#define JOB_SECONDS 0.05
+
+// The size of the jobs sent before any worker reported its speed
+#define INITIAL_JOB_SIZE 65536
+
+// Jobs are never made smaller than this, even at the very end
+#define MIN_JOB_SIZE 4096
+
+// The amount of jobs the job queue should hold for every worker
+#define JOBS_IN_FLIGHT_PER_WORKER 4
+
+// The amount of hashes searched for at a time when streaming, unless the
+// farmer is told another amount
+#define STREAM_WINDOW 65536
+
+// How many seconds apart an elastic pool checks whether to resize, and for
+// how many checks in a row it has to be short of workers or have workers to
+// spare before it does
+#define POOL_INTERVAL 0.1
+#define POOL_PATIENCE 3
+
+/**
+ * @brief Splits the keyspace into jobs. Every sweep over the keyspace is cut
+ * into pieces: first the messages shorter than the prefix, then one piece for
+ * every prefix holding the messages that start with it. Jobs are cut from the
+ * pieces in order and never span two of them.
+ *
+ * When deepening, all sweeps are made once for every length, shortest first.
+ * Jobs then cover a run of consecutive prefixes of the current length, which
+ * are numbered one after the other without a prefix, so that the short
+ * lengths are not cut into tiny jobs. Only the piece without a prefix is used.
+ */
+typedef struct {
+    int alphabet_length; // The amount of chars messages are made of
+    int prefix_length;
+    int max_length; // The length of the longest message
+    uint64_t prefix_count; // The amount of prefixes
+    uint64_t short_count; // The amount of messages shorter than a prefix
+    uint64_t prefix_size; // The amount of messages starting with a prefix
+
+    bool deepening; // Make the sweeps for one length at a time
+    int length; // The length of the messages jobs are cut from when deepening
+
+    size_t sweeps; // The amount of sweeps over the keyspace
+    size_t sweep; // The sweep jobs are cut from
+    uint64_t piece; // The piece jobs are cut from, 0 for the short messages
+    uint64_t offset; // The index of the first message not sent yet
+
+    uint64_t remaining; // The amount of messages not sent yet, or more
+} dispatch_t;
+
+/**
+ * @brief The indices of the messages of a piece that are in the current
+ * sweep, from first up to but not including last
+ */
+static void dispatch_piece_range(const dispatch_t *dispatch, uint64_t piece,
+                                 uint64_t *first, uint64_t *last) {
+    if (!dispatch->deepening) {
+        *first = 0;
+        *last = piece == 0 ? dispatch->short_count : dispatch->prefix_size;
+        return;
+    }
+
+    if (piece == 0) {
+        *first = 0;
+        *last = 0;
+        return;
+    }
+
+    // Messages are numbered shortest first
+    *first = candidates_count(0, dispatch->alphabet_length,
+                              dispatch->length - 1);
+    *last = candidates_count(0, dispatch->alphabet_length, dispatch->length);
+}
+
+static bool dispatch_done(const dispatch_t *dispatch) {
+    return dispatch->sweep == dispatch->sweeps;
+}
+
+/**
+ * @brief Move past the pieces that were sent in full, so that the current
+ * sweep is always the one the next job is cut from
+ */
+static void dispatch_advance(dispatch_t *dispatch) {
+    uint64_t first, last;
+    dispatch_piece_range(dispatch, dispatch->piece, &first, &last);
+
+    while (!dispatch_done(dispatch) && dispatch->offset == last) {
+        dispatch->piece++;
+
+        if (dispatch->piece > dispatch->prefix_count) {
+            dispatch->piece = 0;
+            dispatch->sweep++;
+
+            if (dispatch->sweep == dispatch->sweeps && dispatch->deepening &&
+                dispatch->length < dispatch->max_length) {
+                dispatch->sweep = 0;
+                dispatch->length++;
+            }
+        }
+
+        dispatch_piece_range(dispatch, dispatch->piece, &first, &last);
+        dispatch->offset = first;
+    }
+}
+
+/**
+ * @return false if a sweep has more messages than fit in 64 bits
+ */
+static bool dispatch_init(dispatch_t *dispatch, int alphabet_length,
+                          int prefix_length, int max_length, size_t sweeps,
+                          bool deepening) {
+    // Every prefix is a message of the keyspace itself, so the amount of
+    // them fits whenever the keyspace does
+    if (candidates_count(0, alphabet_length, max_length) == UINT64_MAX) {
+        return false;
+    }
+
+    if (deepening) {
+        prefix_length = 0;
+    }
+
+    dispatch->alphabet_length = alphabet_length;
+    dispatch->prefix_length = prefix_length;
+    dispatch->max_length = max_length;
+    dispatch->prefix_count = 1;
+    for (int i = 0; i < prefix_length; i++) {
+        dispatch->prefix_count *= alphabet_length;
+    }
+
+    dispatch->short_count = candidates_count(0, alphabet_length,
+                                             prefix_length - 1);
+    dispatch->prefix_size = candidates_count(prefix_length, alphabet_length,
+                                             max_length);
+
+    dispatch->deepening = deepening;
+    dispatch->length = 1;
+
+    dispatch->sweeps = sweeps;
+    dispatch->sweep = 0;
+    dispatch->piece = 0;
+
+    uint64_t last;
+    dispatch_piece_range(dispatch, 0, &dispatch->offset, &last);
+
+    // The remaining amount only sizes jobs, so it may saturate
+    uint64_t sweep_size = dispatch->short_count +
+                          dispatch->prefix_count * dispatch->prefix_size;
+
+    if (__builtin_mul_overflow(sweep_size, (uint64_t)sweeps,
+                               &dispatch->remaining)) {
+        dispatch->remaining = UINT64_MAX;
+    }
+
+    dispatch_advance(dispatch);
+
+    return true;
+}
+
+/**
+ * @brief Drop what is left of the current sweep, once its hash is solved.
+ * When deepening only the current length is dropped, the sweeps for longer
+ * lengths are skipped once they are reached.
+ */
+static void dispatch_skip_sweep(dispatch_t *dispatch) {
+    uint64_t first, last;
+    dispatch_piece_range(dispatch, dispatch->piece, &first, &last);
+    uint64_t left = last - dispatch->offset;
+
+    // The pieces after the current one all start with a prefix
+    dispatch_piece_range(dispatch, 1, &first, &last);
+    left += (dispatch->prefix_count - dispatch->piece) * (last - first);
+
+    dispatch->remaining -= left;
+
+    // Let dispatch_advance() move on from the last piece
+    dispatch->piece = dispatch->prefix_count;
+    dispatch->offset = last;
+
+    dispatch_advance(dispatch);
+}
+
+/**
+ * @brief Cut the next job of at most size messages from the current sweep.
+ * Only the range is filled in, the caller fills in what to search for.
+ *
+ * @return false once every sweep is sent
+ */
+static bool dispatch_next(dispatch_t *dispatch, uint64_t size, job_t *job) {
+    if (dispatch_done(dispatch)) {
+        return false;
+    }
+
+    uint64_t first, last;
+    dispatch_piece_range(dispatch, dispatch->piece, &first, &last);
+
+    *job = (job_t){
+        .start = dispatch->offset,
+        .end = last - dispatch->offset < size ? last : dispatch->offset + size,
+        .max_length = dispatch->max_length,
+        .alphabet_start = ALPHABET_START_CHAR,
+        .alphabet_stop = (char)(ALPHABET_START_CHAR +
+                                dispatch->alphabet_length - 1),
+    };
+
+    // The prefix of a piece is its number minus one written in base
+    // alphabet_length
+    if (dispatch->piece > 0) {
+        uint64_t prefix = dispatch->piece - 1;
+
+        job->prefix_length = dispatch->prefix_length;
+        for (int i = dispatch->prefix_length - 1; i >= 0; i--) {
+            job->prefix[i] = ALPHABET_START_CHAR +
+                             prefix % dispatch->alphabet_length;
+            prefix /= dispatch->alphabet_length;
+        }
+    }
+
+    dispatch->remaining -= job->end - job->start;
+    dispatch->offset = job->end;
+
+    dispatch_advance(dispatch);
+
+    return true;
+}
+
+/**
+ * @brief The size of the next job, so that it keeps a worker busy for
+ * JOB_SECONDS at the measured speed. Towards the end jobs shrink so that all
+ * workers finish at about the same time.
+ *
+ * @param rate The measured amount of candidates a worker hashes per second,
+ * with all of its threads, or 0 if it was not measured yet
+ */
+static uint64_t job_size(double rate, uint64_t remaining,
+                         size_t worker_count) {
+    uint64_t size = rate > 0 ? (uint64_t)(rate * JOB_SECONDS)
+                             : INITIAL_JOB_SIZE;
+    uint64_t fair_share = remaining / (2 * worker_count);
+
+    if (size > fair_share) {
+        size = fair_share;
+    }
+
+    return size < MIN_JOB_SIZE ? MIN_JOB_SIZE : size;
+}
+
+static double monotonic_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Summaries of the stats board, printed every interval while dispatching
+typedef struct {
+    stats_board_t *board;
+    double interval; // Seconds between summaries, 0 for none
+    const char *snapshot_path; // Written with every summary, or NULL
+    double last; // When the last summary was printed
+    uint64_t last_candidates; // The amount hashed at the last summary
+    double started; // When dispatching started
+    double first_match; // Seconds from then until the first hash was
+                        // solved, or -1
+} summary_t;
+
+/**
+ * @brief Write the counters of every worker to the snapshot file, after
+ * comments telling how much CPU time the farmer used and how long it took to
+ * solve the first hash. A temporary file is renamed over it, so that readers
+ * never see half of one.
+ */
+static void summary_write_snapshot(const summary_t *summary) {
+    char temporary_path[4096];
+    snprintf(temporary_path, sizeof(temporary_path), "%s.tmp",
+             summary->snapshot_path);
+
+    FILE *file = fopen(temporary_path, "w");
+
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open %s: %s\n", temporary_path,
+                strerror(errno));
+        return;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(file, "# farmer_cpu_seconds %.6f\n",
+            usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+            (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6);
+    fprintf(file, "# first_match_ms %.3f\n",
+            summary->first_match < 0 ? -1 : summary->first_match * 1e3);
+
+    bool written = stats_board_write(summary->board, file);
+
+    if (fclose(file) != 0 || !written ||
+        rename(temporary_path, summary->snapshot_path) == -1) {
+        fprintf(stderr, "Failed to write %s: %s\n", summary->snapshot_path,
+                strerror(errno));
+    }
+}
+
+/**
+ * @brief Print a line telling how fast the workers hashed since the last
+ * summary, how full the queues are and how many workers are busy
+ */
+static void summary_print(summary_t *summary, queue_t *job_queue,
+                          queue_t *response_queue) {
+    double now = monotonic_seconds();
+
+    stats_totals_t totals;
+    stats_totals(summary->board, &totals);
+
+    double rate = (totals.candidates - summary->last_candidates) /
+                  (now - summary->last);
+
+    fprintf(stderr,
+            "farmer: %.2f Mhash/s, %ld/%ld jobs and %ld/%ld responses "
+            "queued, %d/%d workers busy, %lu jobs run, %lu cancelled\n",
+            rate / 1e6, queue_pending(job_queue), queue_capacity(job_queue),
+            queue_pending(response_queue), queue_capacity(response_queue),
+            totals.busy, totals.running, totals.jobs,
+            totals.cancelled);
+
+    summary->last = now;
+    summary->last_candidates = totals.candidates;
+
+    if (summary->snapshot_path != NULL) {
+        summary_write_snapshot(summary);
+    }
+}
+
+/**
+ * @brief Print a summary if one is due
+ *
+ * @param timeout Receives the time until the next summary is due
+ * @return false if no summaries are printed, timeout is not set then
+ */
+static bool summary_poll(summary_t *summary, queue_t *job_queue,
+                         queue_t *response_queue, struct timespec *timeout) {
+    if (summary->interval <= 0) {
+        return false;
+    }
+
+    double left = summary->last + summary->interval - monotonic_seconds();
+
+    if (left <= 0) {
+        summary_print(summary, job_queue, response_queue);
+        left = summary->interval;
+    }
+
+    timeout->tv_sec = (time_t)left;
+    timeout->tv_nsec = (long)((left - timeout->tv_sec) * 1e9);
+
+    return true;
+}
+
+/**
+ * @brief The workers of the farmer. Every worker has a slot on the range and
+ * stats boards, which is handed to the next worker once it exited. An elastic
+ * pool grows while the job queue stays full with every worker busy and a CPU
+ * idle, and shrinks while the job queue stays empty with workers idle.
+ */
+typedef struct {
+    // What every worker is started with
+    queue_backend_t queue_backend;
+    const char *job_queue_name;
+    const char *response_queue_name;
+    const char *target_list_name;
+    const char *range_board_name;
+    const char *stats_board_name;
+    bool daemon; // Workers leave SIGINT to the farmer
+    bool delay_jobs; // Workers delay every job by a random amount
+    const topology_t *topology;
+    placement_policy_t placement_policy;
+    const long *threads; // The amount of hashing threads for every slot
+
+    size_t min; // The least workers to keep running
+    size_t max; // The most workers to run, and the amount of slots
+    pid_t *workers; // The worker in every slot, 0 for a free slot
+    size_t count; // The amount of workers that did not exit yet
+    size_t retiring; // The amount of them sent a shutdown job to resize
+
+    stats_board_t *board;
+    double last_check; // When the pool was last checked for resizing
+    int pressure; // Checks in a row the pool was short of workers, or
+                  // negative, had workers to spare
+} pool_t;
+
+static bool pool_elastic(const pool_t *pool) {
+    return pool->min < pool->max;
+}
+
+// The workers that keep taking jobs
+static size_t pool_active(const pool_t *pool) {
+    return pool->count - pool->retiring;
+}
+
+/**
+ * @brief Start a worker in the first free slot
+ *
+ * @return false if the worker could not be forked
+ */
+static bool pool_spawn(pool_t *pool) {
+    size_t slot = 0;
+    while (pool->workers[slot] != 0) {
+        slot++;
+    }
+
+    placement_t placement;
+    placement_of_worker(pool->topology, pool->placement_policy, pool->max,
+                        slot, &placement);
+
+    pool->board->workers[slot].node = placement.node;
+    pool->board->workers[slot].cpu = placement.cpu;
+
+    // Fork the child
+    pid_t worker = fork();
+
+    // Exit if fork failed for some reason
+    if (worker < 0) {
+        perror("fork() failed");
+        return false;
+    }
+
+    // Replace this process with the worker if it is the fork
+    if (worker == 0) {
+        // Leave stopping the workers of the daemon to the farmer when the
+        // terminal interrupts it
+        if (pool->daemon) {
+            signal(SIGINT, SIG_IGN);
+        }
+
+        if (placement_apply(&placement) == -1) {
+            perror("Failed to place worker");
+        }
+
+        char *worker_arguments[16];
+        size_t worker_argument_count = 0;
+
+        char range_slot[24];
+        snprintf(range_slot, sizeof(range_slot), "%zu", slot);
+
+        char threads[16];
+        snprintf(threads, sizeof(threads), "%ld", pool->threads[slot]);
+
+        worker_arguments[worker_argument_count++] = "worker";
+
+        if (pool->queue_backend == QUEUE_SHM) {
+            worker_arguments[worker_argument_count++] = "-s";
+        }
+
+        if (!pool->delay_jobs) {
+            worker_arguments[worker_argument_count++] = "-R";
+        }
+
+        worker_arguments[worker_argument_count++] = "-t";
+        worker_arguments[worker_argument_count++] =
+            (char *)pool->target_list_name;
+
+        worker_arguments[worker_argument_count++] = "-r";
+        worker_arguments[worker_argument_count++] =
+            (char *)pool->range_board_name;
+        worker_arguments[worker_argument_count++] = "-S";
+        worker_arguments[worker_argument_count++] =
+            (char *)pool->stats_board_name;
+        worker_arguments[worker_argument_count++] = "-w";
+        worker_arguments[worker_argument_count++] = range_slot;
+        worker_arguments[worker_argument_count++] = "-j";
+        worker_arguments[worker_argument_count++] = threads;
+
+        worker_arguments[worker_argument_count++] =
+            (char *)pool->job_queue_name;
+        worker_arguments[worker_argument_count++] =
+            (char *)pool->response_queue_name;
+        worker_arguments[worker_argument_count++] = NULL;
+
+        execvp("./worker", worker_arguments);
+
+        // we should never arrive here...
+        perror("execvp() failed");
+        exit(1);
+    }
+
+    // Save the PID of the worker
+    pool->workers[slot] = worker;
+    pool->count++;
+
+    if (placement.pinned) {
+        fprintf(stderr, "farmer: Worker %d runs on CPU %d of node %d\n",
+                worker, placement.cpu, placement.node);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Ask one worker to exit. The shutdown job is only sent while the job
+ * queue has space, so it is taken by a worker that ran out of jobs.
+ *
+ * @return false if the job queue is full
+ */
+static bool pool_retire(pool_t *pool, queue_t *job_queue) {
+    job_batch_t shutdown = {
+        .count = 1,
+        .jobs = { { .shutdown = true } },
+    };
+
+    if (queue_try_send(job_queue, &shutdown) == -1) {
+        return false;
+    }
+
+    pool->retiring++;
+
+    return true;
+}
+
+/**
+ * @brief Free the slots of the workers that exited
+ */
+static void pool_reap(pool_t *pool) {
+    pid_t worker;
+
+    while ((worker = waitpid(-1, NULL, WNOHANG)) > 0) {
+        size_t slot = 0;
+        while (slot < pool->max && pool->workers[slot] != worker) {
+            slot++;
+        }
+
+        if (slot == pool->max) {
+            continue;
+        }
+
+        fprintf(stderr, "farmer: child %d has finished\n", worker);
+
+        pool->workers[slot] = 0;
+        pool->count--;
+        atomic_store(&pool->board->workers[slot].pid, 0);
+
+        if (pool->retiring > 0) {
+            pool->retiring--;
+        } else {
+            fprintf(stderr, "farmer: Worker %d exited without being asked\n",
+                    worker);
+        }
+    }
+}
+
+/**
+ * @brief The amount of CPUs that nothing is running on at the moment,
+ * counting the farmer itself as not running
+ */
+static long idle_cpus(void) {
+    FILE *file = fopen("/proc/loadavg", "r");
+
+    if (file == NULL) {
+        return 0;
+    }
+
+    // The fourth field counts the runnable threads of the whole system
+    long runnable;
+    int fields = fscanf(file, "%*s %*s %*s %ld/", &runnable);
+    fclose(file);
+
+    if (fields != 1) {
+        return 0;
+    }
+
+    return sysconf(_SC_NPROCESSORS_ONLN) - (runnable - 1);
+}
+
+/**
+ * @brief Grow or shrink an elastic pool once the queues showed the same
+ * pressure for POOL_PATIENCE checks in a row, by one worker at a time
+ *
+ * @param backlog Set if there are jobs the job queue had no space for
+ * @param timeout Receives the time until the next check is due
+ * @return false if the pool is not elastic, timeout is not set then
+ */
+static bool pool_poll(pool_t *pool, queue_t *job_queue, bool backlog,
+                      struct timespec *timeout) {
+    if (!pool_elastic(pool)) {
+        return false;
+    }
+
+    double now = monotonic_seconds();
+    double left = pool->last_check + POOL_INTERVAL - now;
+
+    if (left <= 0) {
+        pool->last_check = now;
+        left = POOL_INTERVAL;
+
+        pool_reap(pool);
+
+        stats_totals_t totals;
+        stats_totals(pool->board, &totals);
+
+        size_t active = pool_active(pool);
+
+        if (backlog && (size_t)totals.busy >= active) {
+            pool->pressure = pool->pressure > 0 ? pool->pressure + 1 : 1;
+        } else if (!backlog && queue_pending(job_queue) == 0 &&
+                   (size_t)totals.busy < active) {
+            pool->pressure = pool->pressure < 0 ? pool->pressure - 1 : -1;
+        } else {
+            pool->pressure = 0;
+        }
+
+        if (pool->pressure >= POOL_PATIENCE && active < pool->max &&
+            pool->count < pool->max && idle_cpus() > 0) {
+            fprintf(stderr, "farmer: Growing the pool to %zu workers\n",
+                    active + 1);
+
+            pool_spawn(pool);
+            pool->pressure = 0;
+        } else if (pool->pressure <= -POOL_PATIENCE && active > pool->min &&
+                   pool_retire(pool, job_queue)) {
+            fprintf(stderr, "farmer: Shrinking the pool to %zu workers\n",
+                    active - 1);
+
+            pool->pressure = 0;
+        }
+    }
+
+    timeout->tv_sec = (time_t)left;
+    timeout->tv_nsec = (long)((left - timeout->tv_sec) * 1e9);
+
+    return true;
+}
+
+/**
+ * @brief The hashes the farmer searches for at the moment: the whole list
+ * from settings.h, or when streaming, the window of hashes last read
+ */
+typedef struct {
+    uint128_t *hashes; // Indexed by hash_id
+    char (*matches)[MESSAGE_LENGTH_LIMIT + 1]; // Empty for unsolved hashes
+    size_t count;
+    size_t solved; // The amount of hashes with a match
+
+    // When streaming, every match is printed to output as soon as it is
+    // found, and the window is only left once the workers reported every sent
+    // candidate done
+    bool streaming;
+    FILE *output;
+    uint64_t sent; // The amount of candidates sent to the workers
+    uint64_t covered; // The amount of them reported done
+} window_t;
+
+static void print_match(FILE *output, uint128_t hash, const char *match) {
+    fprintf(output, "%016lx%016lx '%s'\n", HI(hash), LO(hash), match);
+    fflush(output);
+}
+
+/**
+ * @brief Record the first match of a hash, and let the workers still
+ * searching for the hash give up
+ */
+static void window_solve(window_t *window, target_list_t *target_list,
+                         int hash_id, const char *match) {
+    memcpy(window->matches[hash_id], match, MESSAGE_LENGTH_LIMIT + 1);
+    target_list_solve(target_list, hash_id);
+    window->solved++;
+
+    if (window->streaming) {
+        print_match(window->output, window->hashes[hash_id], match);
+    }
+}
+
+/**
+ * @brief Start searching for the hashes in the window, after looking them up
+ * in the index if there is one
+ */
+static void window_start(window_t *window, target_list_t *target_list,
+                         const digest_index_t *index) {
+    window->solved = 0;
+    window->sent = 0;
+    window->covered = 0;
+    memset(window->matches, 0, sizeof(*window->matches) * window->count);
+
+    target_list_load(target_list, window->hashes, window->count);
+
+    if (index == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < window->count; i++) {
+        char match[MESSAGE_LENGTH_LIMIT + 1] = { '\0' };
+
+        if (digest_index_lookup(index, window->hashes[i], match)) {
+            window_solve(window, target_list, i, match);
+        }
+    }
+
+    fprintf(stderr, "farmer: Found %zu hashes in the index\n",
+            window->solved);
+}
+
+/**
+ * @brief Check if the farmer is done with the window: once every hash is
+ * solved, or once every job is sent, as the keyspace may not have a match for
+ * every hash. The window is only left once every sent job is reported done,
+ * so that no job of it is left when the next window is loaded, or the
+ * workers are shut down.
+ *
+ * @param jobs The jobs that were cut but not sent yet
+ */
+static bool window_finished(const window_t *window, const dispatch_t *dispatch,
+                            const job_batch_t *jobs) {
+    bool solved = window->solved == window->count;
+
+    return (solved || (dispatch_done(dispatch) && jobs->count == 0)) &&
+           window->covered == window->sent;
+}
+
+/**
+ * @brief Parse a hash written as 32 hex digits, as printed by md5sum, which
+ * may be followed by white space and more text
+ *
+ * @return false if the text does not start with a hash
+ */
+static bool parse_hash(const char *text, uint128_t *hash) {
+    uint128_t value = 0;
+
+    for (int i = 0; i < 32; i++) {
+        char digit = tolower((unsigned char)text[i]);
+
+        if (digit >= '0' && digit <= '9') {
+            value = value << 4 | (uint128_t)(digit - '0');
+        } else if (digit >= 'a' && digit <= 'f') {
+            value = value << 4 | (uint128_t)(digit - 'a' + 10);
+        } else {
+            return false;
+        }
+    }
+
+    if (text[32] != '\0' && !isspace((unsigned char)text[32])) {
+        return false;
+    }
+
+    *hash = value;
+
+    return true;
+}
+
+/**
+ * @brief Read the next window of hashes from the input, one hash per line.
+ * Lines without a hash are reported and skipped.
+ *
+ * @param line The number of the last line read, updated
+ * @param blank Set if a blank line ended the window, or NULL to skip blank
+ * lines instead
+ * @return The amount of hashes read, 0 once the input is exhausted
+ */
+static size_t read_window(FILE *input, uint128_t *hashes, size_t capacity,
+                          size_t *line, bool *blank) {
+    size_t count = 0;
+    char text[256];
+
+    if (blank != NULL) {
+        *blank = false;
+    }
+
+    while (count < capacity && fgets(text, sizeof(text), input) != NULL) {
+        size_t length = strlen(text);
+
+        // Drop the rest of a line that did not fit
+        if (length == sizeof(text) - 1 && text[length - 1] != '\n') {
+            int c;
+            while ((c = fgetc(input)) != EOF && c != '\n') {
+            }
+        }
+
+        (*line)++;
+
+        char *start = text;
+        while (isspace((unsigned char)*start)) {
+            start++;
+        }
+
+        if (*start == '\0') {
+            if (blank != NULL) {
+                *blank = true;
+                break;
+            }
+
+            continue;
+        }
+
+        if (!parse_hash(start, &hashes[count])) {
+            fprintf(stderr, "farmer: No hash on line %zu\n", *line);
+            continue;
+        }
+
+        count++;
+    }
+
+    if (ferror(input)) {
+        perror("Failed to read the hashes");
+    }
+
+    return count;
+}
+
+// Set by SIGINT and SIGTERM to stop the daemon once its batch is done
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int signal_number) {
+    (void)signal_number;
+    stop_requested = 1;
+}
+
+/**
+ * @brief Where the hashes come from when streaming: a file, or when running
+ * as a daemon, the connections to its Unix domain socket. A connection sends
+ * batches of hashes, each ended by a blank line or by the end of the
+ * connection, and gets back the results of every batch followed by a blank
+ * line.
+ */
+typedef struct {
+    FILE *input; // NULL while the daemon waits for a connection
+    FILE *output; // Where the results are printed
+    size_t line; // The number of the last line read from input
+    int listener; // The socket of the daemon, -1 if not a daemon
+    bool batch_ending; // The window read last ends a batch
+} source_t;
+
+static void source_disconnect(source_t *source) {
+    fprintf(stderr, "farmer: Closing the connection\n");
+
+    fclose(source->input);
+    fclose(source->output);
+    source->input = NULL;
+    source->output = NULL;
+    source->batch_ending = false;
+}
+
+/**
+ * @brief Wait for the next client of the daemon
+ *
+ * @return false if the daemon was told to stop
+ */
+static bool source_accept(source_t *source) {
+    while (!stop_requested) {
+        int connection = accept(source->listener, NULL, NULL);
+
+        if (connection == -1) {
+            if (errno != EINTR) {
+                perror("Failed to accept a connection");
+                return false;
+            }
+
+            continue;
+        }
+
+        int output_connection = dup(connection);
+        source->input = fdopen(connection, "r");
+        source->output = output_connection == -1
+                             ? NULL
+                             : fdopen(output_connection, "w");
+
+        if (source->input == NULL || source->output == NULL) {
+            perror("Failed to open the connection");
+
+            if (source->input != NULL) {
+                fclose(source->input);
+            } else {
+                close(connection);
+            }
+
+            if (source->output != NULL) {
+                fclose(source->output);
+            } else if (output_connection != -1) {
+                close(output_connection);
+            }
+
+            continue;
+        }
+
+        source->line = 0;
+        fprintf(stderr, "farmer: Accepted a connection\n");
+
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Read the next window of hashes. The daemon first tells the client
+ * when the window before ended its batch, and waits for the next connection
+ * once one is exhausted.
+ *
+ * @return false once there are no more hashes
+ */
+static bool source_next_window(source_t *source, window_t *window,
+                               size_t capacity) {
+    if (source->listener == -1) {
+        window->count = read_window(source->input, window->hashes, capacity,
+                                    &source->line, NULL);
+
+        return window->count > 0;
+    }
+
+    while (true) {
+        if (source->input == NULL && !source_accept(source)) {
+            return false;
+        }
+
+        if (source->batch_ending) {
+            fputc('\n', source->output);
+            fflush(source->output);
+            source->batch_ending = false;
+        }
+
+        bool blank;
+        window->count = read_window(source->input, window->hashes, capacity,
+                                    &source->line, &blank);
+        window->output = source->output;
+
+        source->batch_ending = blank || feof(source->input) ||
+                               ferror(source->input);
+
+        if (window->count > 0) {
+            return true;
+        }
+
+        // An empty batch only gets the blank line
+        if (!blank) {
+            source_disconnect(source);
+        }
+    }
+}
 
 int main(int argc, char *argv[]) {
-    if (argc != 1) {
+    // Sweep the keyspace once for all hashes instead of once per hash
+    bool multi_target = false;
+    // Exchange jobs and responses through shared memory rings instead of
+    // message queues, optionally with a different depth
+    queue_backend_t queue_backend = QUEUE_MQ;
+    long queue_depth = MQ_MAX_MESSAGES;
+    // The amount of chars fixed at the start of the messages of a job
+    long prefix_length = 1;
+    // The length of the longest message to search for
+    long max_length = MAX_MESSAGE_LENGTH;
+    // The amount of hashing threads in every worker
+    long thread_count = 1;
+    // Start one worker per NUMA node, with a thread for every CPU in it,
+    // instead of NROF_WORKERS workers
+    bool worker_per_node = false;
+    // Look the hashes up in a digest index first, and only search for the
+    // ones that are not in it
+    char *index_path = NULL;
+    // Search all hashes for the shortest messages first, instead of
+    // searching every length for one hash before moving on to the next. Jobs
+    // are not cut along prefixes then.
+    bool deepening = false;
+    // Read the hashes from this file, or from stdin for "-", instead of
+    // searching for the ones in settings.h. They are searched for a window
+    // of hashes at a time, and every match is printed as soon as it is found.
+    char *stream_path = NULL;
+    long window_capacity = STREAM_WINDOW;
+    // Stay resident with the workers running, and take batches of hashes
+    // over connections to a Unix domain socket at this path
+    char *socket_path = NULL;
+    // Pin the workers and the farmer to CPUs, see placement_policy_t. One
+    // worker per NUMA node places every worker on its node unless told
+    // otherwise.
+    placement_policy_t placement_policy = PLACEMENT_NONE;
+    bool placement_given = false;
+    // Grow and shrink the pool of workers between these amounts with the
+    // load, instead of keeping NROF_WORKERS workers running
+    long pool_min = 0;
+    long pool_max = 0;
+    // Search messages made of only the first this many chars of the alphabet.
+    // The search ends once all of them are hashed, and hashes of messages
+    // with other chars are printed as ''.
+    long alphabet_length = ALPHABET_LENGTH;
+    // Let the workers start every job straight away instead of after a
+    // random delay, for benchmarks
+    bool delay_jobs = true;
+    // Print a summary of the stats board every this many seconds, and write
+    // the counters of every worker to a snapshot file with every summary and
+    // at the end
+    summary_t summary = { .interval = 0, .first_match = -1 };
+
+    int option;
+    while ((option = getopt(argc, argv,
+                            "msd:p:l:j:ni:Df:w:v:o:u:a:e:c:R")) != -1) {
+        switch (option) {
+            case 'm':
+                multi_target = true;
+                break;
+            case 's':
+                queue_backend = QUEUE_SHM;
+                break;
+            case 'd':
+                queue_depth = strtol(optarg, NULL, 10);
+
+                if (queue_depth <= 0) {
+                    fprintf(stderr, "%s: invalid queue depth\n", argv[0]);
+                    return 1;
+                }
+                break;
+            case 'p':
+                prefix_length = strtol(optarg, NULL, 10);
+                break;
+            case 'l':
+                max_length = strtol(optarg, NULL, 10);
+
+                if (max_length < 1 || max_length > MESSAGE_LENGTH_LIMIT) {
+                    fprintf(stderr, "%s: invalid message length\n", argv[0]);
+                    return 1;
+                }
+                break;
+            case 'j':
+                thread_count = strtol(optarg, NULL, 10);
+
+                if (thread_count <= 0) {
+                    fprintf(stderr, "%s: invalid thread count\n", argv[0]);
+                    return 1;
+                }
+                break;
+            case 'n':
+                worker_per_node = true;
+                break;
+            case 'i':
+                index_path = optarg;
+                break;
+            case 'D':
+                deepening = true;
+                break;
+            case 'f':
+                stream_path = optarg;
+                break;
+            case 'w':
+                window_capacity = strtol(optarg, NULL, 10);
+
+                if (window_capacity <= 0 || window_capacity > INT32_MAX) {
+                    fprintf(stderr, "%s: invalid window size\n", argv[0]);
+                    return 1;
+                }
+                break;
+            case 'v':
+                summary.interval = strtod(optarg, NULL);
+
+                if (summary.interval <= 0) {
+                    fprintf(stderr, "%s: invalid summary interval\n",
+                            argv[0]);
+                    return 1;
+                }
+                break;
+            case 'o':
+                summary.snapshot_path = optarg;
+                break;
+            case 'u':
+                socket_path = optarg;
+                break;
+            case 'a':
+                if (!placement_policy_parse(optarg, &placement_policy)) {
+                    fprintf(stderr, "%s: invalid placement policy\n",
+                            argv[0]);
+                    return 1;
+                }
+
+                placement_given = true;
+                break;
+            case 'e': {
+                char *end;
+                pool_min = strtol(optarg, &end, 10);
+                pool_max = *end == ':' ? strtol(end + 1, NULL, 10) : 0;
+
+                if (pool_min < 1 || pool_max < pool_min) {
+                    fprintf(stderr, "%s: invalid pool size\n", argv[0]);
+                    return 1;
+                }
+                break;
+            }
+            case 'c':
+                alphabet_length = strtol(optarg, NULL, 10);
+
+                if (alphabet_length < 1 || alphabet_length > ALPHABET_LENGTH) {
+                    fprintf(stderr, "%s: invalid alphabet size\n", argv[0]);
+                    return 1;
+                }
+                break;
+            case 'R':
+                delay_jobs = false;
+                break;
+            default:
+                fprintf(stderr, "%s: invalid arguments\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind != argc) {
         fprintf(stderr, "%s: invalid arguments\n", argv[0]);
         return 1;
     }
 
+    if (prefix_length < 0 || prefix_length > max_length) {
+        fprintf(stderr, "%s: invalid prefix length\n", argv[0]);
+        return 1;
+    }
+
+    if (stream_path != NULL && socket_path != NULL) {
+        fprintf(stderr, "%s: -f and -u cannot be combined\n", argv[0]);
+        return 1;
+    }
+
+    if (worker_per_node && pool_max > 0) {
+        fprintf(stderr, "%s: -n and -e cannot be combined\n", argv[0]);
+        return 1;
+    }
+
+    size_t capacity = MD5_LIST_LENGTH;
+    source_t source = { .output = stdout, .listener = -1 };
+
+    if (stream_path != NULL) {
+        capacity = window_capacity;
+        source.input = strcmp(stream_path, "-") == 0 ? stdin
+                                                     : fopen(stream_path, "r");
+
+        if (source.input == NULL) {
+            fprintf(stderr, "Failed to open %s: %s\n", stream_path,
+                    strerror(errno));
+
+            return 1;
+        }
+    }
+
+    if (socket_path != NULL) {
+        capacity = window_capacity;
+
+        struct sockaddr_un address = { .sun_family = AF_UNIX };
+
+        if (strlen(socket_path) >= sizeof(address.sun_path)) {
+            fprintf(stderr, "%s: socket path too long\n", argv[0]);
+            return 1;
+        }
+
+        strcpy(address.sun_path, socket_path);
+
+        // The workers must not keep the socket open
+        source.listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+        if (source.listener == -1) {
+            perror("Failed to create the socket");
+            return 1;
+        }
+
+        // Replace the socket of a daemon that did not shut down cleanly
+        unlink(socket_path);
+
+        if (bind(source.listener, (struct sockaddr *)&address,
+                 sizeof(address)) == -1 ||
+            listen(source.listener, SOMAXCONN) == -1) {
+            fprintf(stderr, "Failed to listen on %s: %s\n", socket_path,
+                    strerror(errno));
+            return 1;
+        }
+
+        // Finish the batch being searched before stopping, and do not die
+        // when a client goes away before its results are written
+        struct sigaction stop_action = { .sa_handler = request_stop };
+        sigaction(SIGINT, &stop_action, NULL);
+        sigaction(SIGTERM, &stop_action, NULL);
+        signal(SIGPIPE, SIG_IGN);
+    }
+
+    window_t window = {
+        .hashes = malloc(sizeof(*window.hashes) * capacity),
+        .matches = malloc(sizeof(*window.matches) * capacity),
+        .streaming = source.input != NULL || source.listener != -1,
+        .output = source.output,
+    };
+
+    if (window.hashes == NULL || window.matches == NULL) {
+        perror("Failed to allocate the window");
+
+        return 1;
+    }
+
+    if (source.listener != -1) {
+        // Connections are only accepted once the workers are running, so
+        // the first window is empty
+        window.count = 0;
+    } else if (window.streaming) {
+        source_next_window(&source, &window, capacity);
+    } else {
+        memcpy(window.hashes, md5_list, sizeof(uint128_t) * MD5_LIST_LENGTH);
+        window.count = MD5_LIST_LENGTH;
+    }
+
+    // A multi-target sweep covers the keyspace for every hash at once,
+    // otherwise every hash gets a sweep of its own
+    dispatch_t dispatch;
+
+    if (!dispatch_init(&dispatch, alphabet_length, prefix_length, max_length,
+                       multi_target ? 1 : window.count, deepening)) {
+        fprintf(stderr, "%s: the keyspace has too many messages\n", argv[0]);
+        return 1;
+    }
+
+    // Decide how many workers to start and how many threads each gets. An
+    // elastic pool starts with its least amount of workers, and has a slot
+    // for the most.
+    size_t worker_count = pool_max > 0 ? (size_t)pool_min : NROF_WORKERS;
+    size_t slot_count = pool_max > 0 ? (size_t)pool_max : NROF_WORKERS;
+    static topology_t topology;
+    topology_detect(&topology);
+
+    if (worker_per_node) {
+        worker_count = topology.node_count;
+        slot_count = worker_count;
+
+        if (!placement_given) {
+            placement_policy = PLACEMENT_NODE;
+        }
+    }
+
+    long worker_threads[slot_count];
+
+    for (size_t i = 0; i < slot_count; i++) {
+        worker_threads[i] = worker_per_node ? topology.nodes[i].cpu_count
+                                            : thread_count;
+    }
+
 #define STUDENT_NAME "zachary_kohnen"
 
     char job_queue_name[128];
     char response_queue_name[128];
+    char target_list_name[128];
+    char range_board_name[128];
+    char stats_board_name[128];
 
     // Name the message queues
     snprintf(job_queue_name,
@@ -48,163 +1288,397 @@ int main(int argc, char *argv[]) {
              "/response_queue_%s_%d",
              STUDENT_NAME, getpid());
 
+    snprintf(target_list_name,
+             sizeof(target_list_name),
+             "/targets_%s_%d",
+             STUDENT_NAME, getpid());
+
+    snprintf(range_board_name,
+             sizeof(range_board_name),
+             "/ranges_%s_%d",
+             STUDENT_NAME, getpid());
+
+    snprintf(stats_board_name,
+             sizeof(stats_board_name),
+             "/stats_%s_%d",
+             STUDENT_NAME, getpid());
+
     // Create the message queues
-    mqd_t job_queue = mq_open(
-        job_queue_name,
-        O_WRONLY | O_CREAT | O_EXCL,
-        0600,
-        &((struct mq_attr){
-            .mq_msgsize = sizeof(job_t),
-            .mq_maxmsg = MQ_MAX_MESSAGES,
-        }));
-
-    if (job_queue == -1) {
+    queue_t job_queue;
+    int job_create = queue_create(&job_queue, queue_backend, job_queue_name,
+                                  sizeof(job_batch_t), queue_depth, O_WRONLY);
+
+    if (job_create == -1) {
         perror("Failed to create job queue");
 
         return 1;
     }
 
-    mqd_t response_queue = mq_open(
-        response_queue_name,
-        O_RDONLY | O_CREAT | O_EXCL,
-        0600,
-        &((struct mq_attr){
-            .mq_msgsize = sizeof(response_t),
-            .mq_maxmsg = MQ_MAX_MESSAGES,
-        }));
+    queue_t response_queue;
+    int response_create = queue_create(&response_queue, queue_backend,
+                                       response_queue_name,
+                                       sizeof(response_batch_t), queue_depth,
+                                       O_RDONLY);
 
-    if (response_queue == -1) {
+    if (response_create == -1) {
         perror("Failed to create response queue");
 
         return 1;
     }
 
-    pid_t workers[NROF_WORKERS] = { 0 };
+    // Share the hashes with the workers for the multi-target jobs, and to
+    // tell them which hashes are solved so they can cancel their jobs
+    target_list_t *target_list = target_list_create(target_list_name,
+                                                    capacity, window.hashes,
+                                                    0);
 
-    // Spawn the children
-    fprintf(stderr, "farmer: Spawning workers\n");
-    for (size_t i = 0; i < NROF_WORKERS; i++) {
-        pid_t worker;
+    if (target_list == NULL) {
+        perror("Failed to create target list");
+
+        return 1;
+    }
+
+    digest_index_t index;
 
-        // Fork the child
-        worker = fork();
+    if (index_path != NULL) {
+        if (!digest_index_open(&index, index_path)) {
+            fprintf(stderr, "Failed to open index %s: %s\n", index_path,
+                    strerror(errno));
 
-        // Exit if fork failed for some reason
-        if (worker < 0) {
-            perror("fork() failed");
             return 1;
         }
 
-        // Replace this process with the worker if it is the fork
-        if (worker == 0) {
-            execlp("./worker",
-                   "worker",
-                   job_queue_name,
-                   response_queue_name, NULL);
+        if (index.header->alphabet_start != ALPHABET_START_CHAR ||
+            index.header->alphabet_stop !=
+                ALPHABET_START_CHAR + alphabet_length - 1 ||
+            index.header->max_length > max_length) {
+            fprintf(stderr, "Index %s is for a different keyspace\n",
+                    index_path);
+
+            return 1;
+        }
+    }
+
+    window_start(&window, target_list, index_path != NULL ? &index : NULL);
+
+    // No workers are needed when the index had every hash, unless more
+    // hashes are streamed in later. The slots are kept so that the arrays
+    // sized by them are never empty.
+    if (!window.streaming && window.solved == window.count) {
+        worker_count = 0;
+    }
+
+    // Lets idle workers steal from the jobs of busy workers
+    range_board_t *range_board = range_board_create(range_board_name,
+                                                    slot_count);
+
+    if (range_board == NULL) {
+        perror("Failed to create range board");
+
+        return 1;
+    }
+
+    // Where the workers count what they are doing
+    summary.board = stats_board_create(
+        stats_board_name, slot_count,
+        placement_policy_names[placement_policy]);
 
-            // we should never arrive here...
-            perror("execlp() failed");
+    if (summary.board == NULL) {
+        perror("Failed to create stats board");
+
+        return 1;
+    }
+
+    // Used to sleep while the job queue is full and no responses are waiting
+    queue_waiter_t waiter;
+
+    if (queue_waiter_init(&waiter, &job_queue, &response_queue) == -1) {
+        perror("Failed to set up waiting on the queues");
+
+        return 1;
+    }
+
+    pid_t workers[slot_count];
+    memset(workers, 0, sizeof(workers));
+
+    pool_t pool = {
+        .queue_backend = queue_backend,
+        .job_queue_name = job_queue_name,
+        .response_queue_name = response_queue_name,
+        .target_list_name = target_list_name,
+        .range_board_name = range_board_name,
+        .stats_board_name = stats_board_name,
+        .daemon = source.listener != -1,
+        .delay_jobs = delay_jobs,
+        .topology = &topology,
+        .placement_policy = placement_policy,
+        .threads = worker_threads,
+        .min = worker_count,
+        .max = slot_count,
+        .workers = workers,
+        .board = summary.board,
+        .last_check = monotonic_seconds(),
+    };
+
+    // Spawn the children
+    fprintf(stderr, "farmer: Spawning workers, placed with the %s policy\n",
+            placement_policy_names[placement_policy]);
+    for (size_t i = 0; i < worker_count; i++) {
+        if (!pool_spawn(&pool)) {
             return 1;
         }
+    }
+
+    // Keep the farmer off the cores of the workers
+    placement_t farmer_placement;
+    placement_of_farmer(&topology, placement_policy, slot_count,
+                        &farmer_placement);
+
+    if (placement_apply(&farmer_placement) == -1) {
+        perror("Failed to place farmer");
+    } else if (farmer_placement.pinned) {
+        fprintf(stderr, "farmer: Farmer runs on CPU %d of node %d\n",
+                farmer_placement.cpu, farmer_placement.node);
+    }
 
-        // Save the PID and queues of the farmer
-        workers[i] = worker;
+    // The measured amount of candidates a worker hashes per second
+    double rate = 0;
+
+    // Pack more jobs into a message the fewer messages the job queue holds
+    long job_depth = queue_capacity(&job_queue);
+
+    if (job_depth == -1) {
+        perror("Failed to get the depth of the job queue");
+        return 1;
     }
 
-    size_t sent_jobs = 0, received_responses = 0;
-    char matches[MD5_LIST_LENGTH][MAX_MESSAGE_LENGTH + 1] = { { '\0' } };
+    int jobs_per_message = batch_size(job_depth,
+                                      JOBS_IN_FLIGHT_PER_WORKER * slot_count,
+                                      JOB_BATCH_MAX);
+
+    // Jobs that did not fit in the job queue yet
+    job_batch_t jobs = { .count = 0 };
 
     // Dispatch jobs
     fprintf(stderr, "farmer: Dispatching jobs\n");
-    while (received_responses < MD5_LIST_LENGTH) {
-        // Fill up the job buffers
-        while (sent_jobs < JOBS_COUNT) {
-            struct mq_attr attributes;
-            int attr_status = mq_getattr(job_queue, &attributes);
-
-            if (attr_status == -1) {
-                perror("Failed to get attributes of job queue");
-                return 1;
-            }
 
-            // Do not attempt to send job if the queue is full
-            if (attributes.mq_curmsgs == MQ_MAX_MESSAGES) {
-                break;
+    // Used to log how long it took to solve every hash
+    struct timespec dispatch_started;
+    clock_gettime(CLOCK_MONOTONIC, &dispatch_started);
+
+    summary.last = monotonic_seconds();
+    summary.started = summary.last;
+
+    while (true) {
+        while (!window_finished(&window, &dispatch, &jobs)) {
+            // The jobs that were not sent yet are no longer needed
+            if (window.solved == window.count) {
+                jobs.count = 0;
             }
 
-            job_t job = {
-                .hash = md5_list[sent_jobs / ALPHABET_LENGTH],
-                .hash_id = sent_jobs / ALPHABET_LENGTH,
-                .starting_char = ALPHABET_START_CHAR +
-                                 sent_jobs % ALPHABET_LENGTH,
-                .alphabet_start = ALPHABET_START_CHAR,
-                .alphabet_stop = ALPHABET_END_CHAR,
-            };
+            // Fill up the job buffers
+            while (jobs.count > 0 || !dispatch_done(&dispatch)) {
+                while (jobs.count < jobs_per_message &&
+                       !dispatch_done(&dispatch)) {
+                    // Skip the sweeps of hashes that got solved before they
+                    // were sent in full
+                    if (multi_target
+                            ? window.solved == window.count
+                            : window.matches[dispatch.sweep][0] != '\0') {
+                        dispatch_skip_sweep(&dispatch);
+                        continue;
+                    }
 
-            fprintf(stderr, "farmer: Sending job %c 0x%016lx\n",
-                    job.starting_char,
-                    HI(job.hash));
+                    size_t sweep = dispatch.sweep;
+                    job_t *job = &jobs.jobs[jobs.count];
 
-            int send_status = mq_send(job_queue, (char *)&job,
-                                      sizeof(job_t), 0);
+                    dispatch_next(&dispatch,
+                                  job_size(rate, dispatch.remaining,
+                                           pool_active(&pool)),
+                                  job);
 
-            if (send_status == -1) {
-                perror("Failed to send job to worker");
-                return 1;
-            }
+                    if (multi_target) {
+                        job->hash_id = -1;
+                        job->all_targets = true;
+                    } else {
+                        job->hash = window.hashes[sweep];
+                        job->hash_id = sweep;
+                    }
 
-            sent_jobs++;
-        }
+                    jobs.count++;
+                }
 
-        // Try to receieve all of the avaliable jobs
-        while (received_responses < MD5_LIST_LENGTH) {
-            struct mq_attr attributes;
-            int status = mq_getattr(response_queue, &attributes);
+                // Every sweep that was left got skipped
+                if (jobs.count == 0) {
+                    break;
+                }
 
-            if (status == -1) {
-                perror("Failed to get attributes of response queue");
-                return 1;
-            }
+                int send_status = queue_try_send(&job_queue, &jobs);
 
-            // Do not attempt to read from an empty message queue
-            if (attributes.mq_curmsgs == 0) {
-                break;
+                // Stop filling the queue once it is full
+                if (send_status == -1 && errno == EAGAIN) {
+                    break;
+                }
+
+                if (send_status == -1) {
+                    perror("Failed to send job to worker");
+                    return 1;
+                }
+
+                for (int i = 0; i < jobs.count; i++) {
+                    job_t *job = &jobs.jobs[i];
+
+                    fprintf(stderr,
+                            "farmer: Sent job '%.*s' [%lu, %lu) 0x%016lx\n",
+                            job->prefix_length, job->prefix, job->start,
+                            job->end, HI(job->hash));
+
+                    window.sent += job->end - job->start;
+                }
+
+                jobs.count = 0;
             }
 
-            fprintf(stderr, "farmer: Receiving response\n");
+            // Try to receieve all of the avaliable jobs
+            while (!window_finished(&window, &dispatch, &jobs)) {
+                response_batch_t responses;
+                ssize_t receive_status = queue_try_receive(&response_queue,
+                                                           &responses);
+
+                // Stop once the queue is empty
+                if (receive_status == -1 && errno == EAGAIN) {
+                    break;
+                }
+
+                if (receive_status == -1) {
+                    perror("parent: Failed to receive respone");
+
+                    return 1;
+                }
+
+                for (int i = 0; i < responses.count; i++) {
+                    response_t *response = &responses.responses[i];
+
+                    // Keep a running average of the speed of the workers
+                    if (response->done) {
+                        if (response->nanoseconds > 0) {
+                            double job_rate = response->candidates * 1e9 /
+                                              response->nanoseconds;
+
+                            rate = rate == 0 ? job_rate
+                                             : rate * 0.75 + job_rate * 0.25;
+                        }
+
+                        window.covered += response->covered;
+
+                        continue;
+                    }
+
+                    fprintf(stderr, "farmer: Received response\n");
+
+                    // Only count the first match of a hash, a multi-target
+                    // sweep can report a hash again if it has more than one
+                    // preimage
+                    if (window.matches[response->hash_id][0] == '\0') {
+                        window_solve(&window, target_list, response->hash_id,
+                                     response->match);
+
+                        if (summary.first_match < 0) {
+                            summary.first_match = monotonic_seconds() -
+                                                  summary.started;
+                        }
+
+                        struct timespec now;
+                        clock_gettime(CLOCK_MONOTONIC, &now);
 
-            response_t response;
-            ssize_t receive_status = mq_receive(
-                response_queue,
-                (char *)&response,
-                sizeof(job_t), NULL);
+                        fprintf(stderr,
+                                "farmer: Solved hash %d after %.1f ms\n",
+                                response->hash_id,
+                                (now.tv_sec - dispatch_started.tv_sec) * 1e3 +
+                                (now.tv_nsec - dispatch_started.tv_nsec) /
+                                1e6);
+                    }
+                }
+            }
+
+            // Sleep until a worker takes a job or sends a response, or the
+            // next summary or resize check is due
+            struct timespec until_summary, until_check;
+            bool summarizing = summary_poll(&summary, &job_queue,
+                                            &response_queue, &until_summary);
+            bool checking = pool_poll(&pool, &job_queue, jobs.count > 0,
+                                      &until_check);
+            const struct timespec *timeout = summarizing ? &until_summary
+                                                         : NULL;
 
-            if (receive_status == -1) {
-                perror("parent: Failed to receive respone");
+            if (checking &&
+                (timeout == NULL || until_check.tv_sec < timeout->tv_sec ||
+                 (until_check.tv_sec == timeout->tv_sec &&
+                  until_check.tv_nsec < timeout->tv_nsec))) {
+                timeout = &until_check;
+            }
 
+            if (!window_finished(&window, &dispatch, &jobs) &&
+                queue_wait(&waiter,
+                           jobs.count > 0 || !dispatch_done(&dispatch),
+                           timeout) == -1) {
+                perror("Failed to wait on the queues");
                 return 1;
             }
+        }
+
+        if (!window.streaming) {
+            break;
+        }
+
+        // The matches were printed as they were found, only the hashes
+        // without one are left
+        for (size_t i = 0; i < window.count; i++) {
+            if (window.matches[i][0] == '\0') {
+                print_match(window.output, window.hashes[i], "");
+            }
+        }
 
-            char *response_match = matches[response.hash_id];
+        // Hand back the cores of the workers that were added for this
+        // window while waiting for the next one
+        if (pool_elastic(&pool)) {
+            pool_reap(&pool);
 
-            memcpy(response_match, response.match,
-                   MAX_MESSAGE_LENGTH + 1);
+            while (pool_active(&pool) > pool.min &&
+                   pool_retire(&pool, &job_queue)) {
+                fprintf(stderr, "farmer: Shrinking the pool to %zu workers\n",
+                        pool_active(&pool));
+            }
+        }
 
-            received_responses++;
+        if (!source_next_window(&source, &window, capacity)) {
+            break;
         }
+
+        window_start(&window, target_list,
+                     index_path != NULL ? &index : NULL);
+        dispatch_init(&dispatch, alphabet_length, prefix_length, max_length,
+                      multi_target ? 1 : window.count, deepening);
     }
 
+    queue_waiter_close(&waiter);
+
     // Print the received matches
-    for (int i = 0; i < MD5_LIST_LENGTH; i++) {
-        printf("'%s'\n", matches[i]);
+    if (!window.streaming) {
+        for (size_t i = 0; i < window.count; i++) {
+            printf("'%s'\n", window.matches[i]);
+        }
     }
 
     // Send the shutdown message to all children
     fprintf(stderr, "farmer: Shutting down children\n");
-    for (size_t i = 0; i < NROF_WORKERS; i++) {
-        int status = mq_send(job_queue,
-                             (char *)&((job_t){ .starting_char = '\0' }),
-                             sizeof(job_t), 0);
+    for (size_t i = 0; i < pool_active(&pool); i++) {
+        job_batch_t shutdown = {
+            .count = 1,
+            .jobs = { { .shutdown = true } },
+        };
+
+        int status = queue_send(&job_queue, &shutdown);
 
         if (status == -1) {
             perror("Failed to send stop job to worker");
@@ -214,9 +1688,14 @@ int main(int argc, char *argv[]) {
 
     // Wait for all of the children
     fprintf(stderr, "farmer: Waiting for children\n");
-    for (size_t i = 0; i < NROF_WORKERS; i++) {
+    for (size_t i = 0; i < slot_count; i++) {
         pid_t worker = workers[i];
 
+        // The slot is free, or its worker was already waited for
+        if (worker == 0) {
+            continue;
+        }
+
         fprintf(stderr, "farmer: Waiting for %d\n", worker);
         // Wait for the child
         waitpid(worker, NULL, 0);
@@ -226,30 +1705,35 @@ int main(int argc, char *argv[]) {
         worker = 0;
     }
 
+    if (summary.snapshot_path != NULL) {
+        summary_write_snapshot(&summary);
+    }
+
     // Close the message queues
     {
-        int job_close = mq_close(job_queue);
+        int job_close = queue_close(&job_queue);
 
         if (job_close == -1) {
             perror("Failed to close job queue");
             return 1;
         }
 
-        int job_unlink = mq_unlink(job_queue_name);
+        int job_unlink = queue_unlink(queue_backend, job_queue_name);
 
         if (job_unlink == -1) {
             perror("Failed to unlink job queue");
             return 1;
         }
 
-        int response_close = mq_close(response_queue);
+        int response_close = queue_close(&response_queue);
 
         if (response_close == -1) {
             perror("Failed to close job queue");
             return 1;
         }
 
-        int response_unlink = mq_unlink(response_queue_name);
+        int response_unlink = queue_unlink(queue_backend,
+                                           response_queue_name);
 
         if (response_unlink == -1) {
             perror("Failed to unlink job queue");
@@ -257,5 +1741,59 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    // Remove the target list
+    {
+        target_list_close(target_list);
+
+        int target_list_unlink = shm_unlink(target_list_name);
+
+        if (target_list_unlink == -1) {
+            perror("Failed to unlink target list");
+            return 1;
+        }
+    }
+
+    if (index_path != NULL) {
+        digest_index_close(&index);
+    }
+
+    if (source.listener != -1) {
+        if (source.input != NULL) {
+            source_disconnect(&source);
+        }
+
+        close(source.listener);
+        unlink(socket_path);
+    } else if (source.input != NULL && source.input != stdin) {
+        fclose(source.input);
+    }
+
+    free(window.hashes);
+    free(window.matches);
+
+    // Remove the stats board
+    {
+        stats_board_close(summary.board);
+
+        int stats_board_unlink = shm_unlink(stats_board_name);
+
+        if (stats_board_unlink == -1) {
+            perror("Failed to unlink stats board");
+            return 1;
+        }
+    }
+
+    // Remove the range board
+    {
+        range_board_close(range_board);
+
+        int range_board_unlink = shm_unlink(range_board_name);
+
+        if (range_board_unlink == -1) {
+            perror("Failed to unlink range board");
+            return 1;
+        }
+    }
+
     return 0;
 }
@@ -0,0 +1,174 @@
+/*
+ * Operating Systems (2INCO) Practical Assignment
+ * Interprocess Communication
+ *
+ * Zachary Kohnen (1655221)
+ *
+ * Offline builder of the digest index. Hashes every message of the keyspace
+ * in settings.h once and writes the digests, sorted, to the given file, which
+ * the farmer maps with -i.
+ *
+ * usage: index_builder [-l max_length] <file>
+ *
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "candidates.h"
+#include "common.h"
+#include "digest_index.h"
+#include "md5_kernel.h"
+// Only the constants of settings.h are needed, not the hashes it defines
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#include "settings.h" // definition of work
+#pragma GCC diagnostic pop
+
+/**
+ * @brief Sort the entries by key. A radix sort over the bytes of the key,
+ * lowest byte first, which keeps equal keys in message order.
+ *
+ * @param scratch Space for as many entries as there are to sort
+ */
+static void sort_entries(digest_index_entry_t *entries,
+                         digest_index_entry_t *scratch, uint64_t count) {
+    for (int shift = 0; shift < 32; shift += 8) {
+        uint64_t offsets[256] = { 0 };
+
+        for (uint64_t i = 0; i < count; i++) {
+            offsets[(entries[i].key >> shift) & 0xff]++;
+        }
+
+        uint64_t offset = 0;
+        for (int digit = 0; digit < 256; digit++) {
+            uint64_t digit_count = offsets[digit];
+            offsets[digit] = offset;
+            offset += digit_count;
+        }
+
+        for (uint64_t i = 0; i < count; i++) {
+            scratch[offsets[(entries[i].key >> shift) & 0xff]++] = entries[i];
+        }
+
+        digest_index_entry_t *sorted = scratch;
+        scratch = entries;
+        entries = sorted;
+    }
+
+    // After an even amount of passes the sorted entries are back in entries
+}
+
+int main(int argc, char *argv[]) {
+    long max_length = MAX_MESSAGE_LENGTH;
+
+    int option;
+    while ((option = getopt(argc, argv, "l:")) != -1) {
+        switch (option) {
+            case 'l':
+                max_length = strtol(optarg, NULL, 10);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-l max_length] <file>\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind != 1 || max_length < 1 ||
+        max_length > MESSAGE_LENGTH_LIMIT) {
+        fprintf(stderr, "usage: %s [-l max_length] <file>\n", argv[0]);
+        return 1;
+    }
+
+    const char *path = argv[optind];
+
+    uint64_t count = candidates_count(0, ALPHABET_LENGTH, max_length);
+
+    // Messages are stored as 32 bit indices
+    if (count > UINT32_MAX) {
+        fprintf(stderr, "%s: the keyspace has too many messages\n", argv[0]);
+        return 1;
+    }
+
+    digest_index_entry_t *entries = malloc(sizeof(*entries) * count);
+    digest_index_entry_t *scratch = malloc(sizeof(*scratch) * count);
+
+    if (entries == NULL || scratch == NULL) {
+        perror("Failed to allocate the entries");
+        return 1;
+    }
+
+    md5_kernel_t kernel = md5_kernel_select();
+    fprintf(stderr, "index_builder: Hashing %lu messages with the %s kernel\n",
+            count, kernel.name);
+
+    candidates_t candidates;
+    candidates_init(&candidates, "", 0, ALPHABET_START_CHAR, ALPHABET_END_CHAR,
+                    max_length);
+
+    md5_batch_t batch = { .count = 0 };
+    md5_digests_t digests;
+    uint64_t message = 0;
+
+    while (candidates_next_batch(&candidates, &batch)) {
+        kernel.hash(&batch, &digests);
+
+        for (int lane = 0; lane < batch.count; lane++) {
+            entries[message] = (digest_index_entry_t){
+                .key = digests.state[0][lane],
+                .message = (uint32_t)message,
+            };
+            message++;
+        }
+    }
+
+    fprintf(stderr, "index_builder: Sorting\n");
+    sort_entries(entries, scratch, count);
+    free(scratch);
+
+    digest_index_header_t header = {
+        .magic = DIGEST_INDEX_MAGIC,
+        .layout = md5_layout,
+        .alphabet_start = ALPHABET_START_CHAR,
+        .alphabet_stop = ALPHABET_END_CHAR,
+        .max_length = max_length,
+        .count = count,
+    };
+
+    // Write to a temporary file first, so a farmer never maps half an index
+    char temporary_path[4096];
+    snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", path);
+
+    FILE *file = fopen(temporary_path, "wb");
+
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open %s: %s\n", temporary_path,
+                strerror(errno));
+        return 1;
+    }
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+        fwrite(entries, sizeof(*entries), count, file) != count ||
+        fclose(file) != 0) {
+        fprintf(stderr, "Failed to write %s: %s\n", temporary_path,
+                strerror(errno));
+        return 1;
+    }
+
+    if (rename(temporary_path, path) == -1) {
+        fprintf(stderr, "Failed to rename %s: %s\n", temporary_path,
+                strerror(errno));
+        return 1;
+    }
+
+    free(entries);
+
+    fprintf(stderr, "index_builder: Wrote %s\n", path);
+
+    return 0;
+}
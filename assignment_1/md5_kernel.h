@@ -0,0 +1,794 @@
+/*
+ * Operating Systems (2INCO) Practical Assignment
+ * Interprocess Communication
+ *
+ * Zachary Kohnen (1655221)
+ *
+ * Multi-lane MD5 kernels which hash a whole batch of candidate messages at
+ * once using SIMD lanes. The kernel is picked at runtime based on the features
+ * of the CPU, with md5s() as the fallback when no vector kernel can be used.
+ *
+ */
+
+#ifndef MD5_KERNEL_H_
+#define MD5_KERNEL_H_
+
+#include <immintrin.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "md5s.h"
+#include "uint128.h"
+
+// Amount of messages in one batch, the widest kernel (AVX-512) hashes all of
+// them at once while narrower kernels loop over the batch
+#define MD5_BATCH_LANES 16
+
+// Longest message that still fits in a single padded MD5 block
+#define MD5_BLOCK_MAX_MESSAGE 55
+
+// A batch of messages of equal length, each padded into a single MD5 block.
+// The words are stored word major so that a kernel can load one word of every
+// lane with a single vector load: words[w][lane]
+typedef struct {
+    uint32_t words[16][MD5_BATCH_LANES];
+    int length; // The length of every message in the batch
+    int count; // The amount of lanes which hold a message
+} md5_batch_t;
+
+// The raw MD5 state words (a, b, c, d) of every lane in a batch
+typedef struct {
+    uint32_t state[4][MD5_BATCH_LANES];
+} md5_digests_t;
+
+// A hash to search for, pre-split into MD5 state words
+typedef struct {
+    uint128_t hash;
+    uint32_t state[4];
+} md5_target_t;
+
+// Amount of specialised plan kernels, see md5_plan_init()
+#define MD5_PLAN_VARIANTS 5
+
+/**
+ * @brief First step which only reads words that are equal for every candidate,
+ * when words 0..varying - 1 differ between candidates. This step and all steps
+ * after it can be undone starting from the target hash.
+ */
+#define MD5_FIRST_REVERSED_STEP(varying) \
+    ((varying) == 1 ? 49 : (varying) == 2 ? 56 : (varying) <= 4 ? 63 : 64)
+
+// The step which computes the last state word that is not undone. It is the
+// earliest point at which a candidate can be ruled out.
+#define MD5_EARLY_STEP(varying) (MD5_FIRST_REVERSED_STEP(varying) - 4)
+
+/**
+ * @brief Everything about searching for one target that only depends on the
+ * words that are equal for all candidates of one length
+ */
+typedef struct {
+    md5_target_t target;
+    int length; // The message length the plan was made for, 0 if none yet
+    int varying; // Words 0..varying - 1 differ between candidates
+    int variant; // The plan kernel which handles this amount of varying words
+    uint32_t constants[64]; // Step constants with the fixed words folded in
+    uint32_t early; // The value MD5_EARLY_STEP must produce for a match
+} md5_plan_t;
+
+// Hashes every message in the batch into the digests
+typedef void (*md5_kernel_fn)(const md5_batch_t *batch,
+                              md5_digests_t *digests);
+
+// Runs every message in the batch up to MD5_EARLY_STEP and returns a bitmask
+// of the lanes that could still match the target of the plan
+typedef uint32_t (*md5_plan_fn)(const md5_batch_t *batch,
+                                const md5_plan_t *plan);
+
+typedef struct {
+    const char *name;
+    md5_kernel_fn hash;
+    md5_plan_fn plan[MD5_PLAN_VARIANTS]; // NULL if plans are not supported
+} md5_kernel_t;
+
+/**
+ * @brief How md5s() packs the 16 digest bytes into a uint128_t. This decides
+ * how a kernel's state words relate to the hashes given in the jobs.
+ */
+typedef enum {
+    // Unknown packing, only md5s() may be used and the split is arbitrary
+    MD5_LAYOUT_RAW,
+    // The first digest byte is the most significant byte
+    MD5_LAYOUT_BIG_ENDIAN,
+    // The first digest byte is the least significant byte
+    MD5_LAYOUT_LITTLE_ENDIAN,
+} md5_layout_t;
+
+static md5_layout_t md5_layout = MD5_LAYOUT_RAW;
+
+#define MD5_INIT_A 0x67452301
+#define MD5_INIT_B 0xefcdab89
+#define MD5_INIT_C 0x98badcfe
+#define MD5_INIT_D 0x10325476
+
+/**
+ * @brief X-macro listing all 64 MD5 steps in order as
+ * STEP(index, function, a, b, c, d, word, constant, shift)
+ */
+#define MD5_STEPS(STEP)                                        \
+    STEP(0, F, a, b, c, d, 0, 0xd76aa478, 7)                   \
+    STEP(1, F, d, a, b, c, 1, 0xe8c7b756, 12)                  \
+    STEP(2, F, c, d, a, b, 2, 0x242070db, 17)                  \
+    STEP(3, F, b, c, d, a, 3, 0xc1bdceee, 22)                  \
+    STEP(4, F, a, b, c, d, 4, 0xf57c0faf, 7)                   \
+    STEP(5, F, d, a, b, c, 5, 0x4787c62a, 12)                  \
+    STEP(6, F, c, d, a, b, 6, 0xa8304613, 17)                  \
+    STEP(7, F, b, c, d, a, 7, 0xfd469501, 22)                  \
+    STEP(8, F, a, b, c, d, 8, 0x698098d8, 7)                   \
+    STEP(9, F, d, a, b, c, 9, 0x8b44f7af, 12)                  \
+    STEP(10, F, c, d, a, b, 10, 0xffff5bb1, 17)                \
+    STEP(11, F, b, c, d, a, 11, 0x895cd7be, 22)                \
+    STEP(12, F, a, b, c, d, 12, 0x6b901122, 7)                 \
+    STEP(13, F, d, a, b, c, 13, 0xfd987193, 12)                \
+    STEP(14, F, c, d, a, b, 14, 0xa679438e, 17)                \
+    STEP(15, F, b, c, d, a, 15, 0x49b40821, 22)                \
+    STEP(16, G, a, b, c, d, 1, 0xf61e2562, 5)                  \
+    STEP(17, G, d, a, b, c, 6, 0xc040b340, 9)                  \
+    STEP(18, G, c, d, a, b, 11, 0x265e5a51, 14)                \
+    STEP(19, G, b, c, d, a, 0, 0xe9b6c7aa, 20)                 \
+    STEP(20, G, a, b, c, d, 5, 0xd62f105d, 5)                  \
+    STEP(21, G, d, a, b, c, 10, 0x02441453, 9)                 \
+    STEP(22, G, c, d, a, b, 15, 0xd8a1e681, 14)                \
+    STEP(23, G, b, c, d, a, 4, 0xe7d3fbc8, 20)                 \
+    STEP(24, G, a, b, c, d, 9, 0x21e1cde6, 5)                  \
+    STEP(25, G, d, a, b, c, 14, 0xc33707d6, 9)                 \
+    STEP(26, G, c, d, a, b, 3, 0xf4d50d87, 14)                 \
+    STEP(27, G, b, c, d, a, 8, 0x455a14ed, 20)                 \
+    STEP(28, G, a, b, c, d, 13, 0xa9e3e905, 5)                 \
+    STEP(29, G, d, a, b, c, 2, 0xfcefa3f8, 9)                  \
+    STEP(30, G, c, d, a, b, 7, 0x676f02d9, 14)                 \
+    STEP(31, G, b, c, d, a, 12, 0x8d2a4c8a, 20)                \
+    STEP(32, H, a, b, c, d, 5, 0xfffa3942, 4)                  \
+    STEP(33, H, d, a, b, c, 8, 0x8771f681, 11)                 \
+    STEP(34, H, c, d, a, b, 11, 0x6d9d6122, 16)                \
+    STEP(35, H, b, c, d, a, 14, 0xfde5380c, 23)                \
+    STEP(36, H, a, b, c, d, 1, 0xa4beea44, 4)                  \
+    STEP(37, H, d, a, b, c, 4, 0x4bdecfa9, 11)                 \
+    STEP(38, H, c, d, a, b, 7, 0xf6bb4b60, 16)                 \
+    STEP(39, H, b, c, d, a, 10, 0xbebfbc70, 23)                \
+    STEP(40, H, a, b, c, d, 13, 0x289b7ec6, 4)                 \
+    STEP(41, H, d, a, b, c, 0, 0xeaa127fa, 11)                 \
+    STEP(42, H, c, d, a, b, 3, 0xd4ef3085, 16)                 \
+    STEP(43, H, b, c, d, a, 6, 0x04881d05, 23)                 \
+    STEP(44, H, a, b, c, d, 9, 0xd9d4d039, 4)                  \
+    STEP(45, H, d, a, b, c, 12, 0xe6db99e5, 11)                \
+    STEP(46, H, c, d, a, b, 15, 0x1fa27cf8, 16)                \
+    STEP(47, H, b, c, d, a, 2, 0xc4ac5665, 23)                 \
+    STEP(48, I, a, b, c, d, 0, 0xf4292244, 6)                  \
+    STEP(49, I, d, a, b, c, 7, 0x432aff97, 10)                 \
+    STEP(50, I, c, d, a, b, 14, 0xab9423a7, 15)                \
+    STEP(51, I, b, c, d, a, 5, 0xfc93a039, 21)                 \
+    STEP(52, I, a, b, c, d, 12, 0x655b59c3, 6)                 \
+    STEP(53, I, d, a, b, c, 3, 0x8f0ccc92, 10)                 \
+    STEP(54, I, c, d, a, b, 10, 0xffeff47d, 15)                \
+    STEP(55, I, b, c, d, a, 1, 0x85845dd1, 21)                 \
+    STEP(56, I, a, b, c, d, 8, 0x6fa87e4f, 6)                  \
+    STEP(57, I, d, a, b, c, 15, 0xfe2ce6e0, 10)                \
+    STEP(58, I, c, d, a, b, 6, 0xa3014314, 15)                 \
+    STEP(59, I, b, c, d, a, 13, 0x4e0811a1, 21)                \
+    STEP(60, I, a, b, c, d, 4, 0xf7537e82, 6)                  \
+    STEP(61, I, d, a, b, c, 11, 0xbd3af235, 10)                \
+    STEP(62, I, c, d, a, b, 2, 0x2ad7d2bb, 15)                 \
+    STEP(63, I, b, c, d, a, 9, 0xeb86d391, 21)
+
+#define MD5_TABLE_WORD(i, f, a, b, c, d, w, k, s) w,
+#define MD5_TABLE_CONSTANT(i, f, a, b, c, d, w, k, s) k,
+#define MD5_TABLE_SHIFT(i, f, a, b, c, d, w, k, s) s,
+
+static const uint8_t md5_step_word[64] = { MD5_STEPS(MD5_TABLE_WORD) };
+static const uint32_t md5_step_constant[64] = {
+    MD5_STEPS(MD5_TABLE_CONSTANT)
+};
+static const uint8_t md5_step_shift[64] = { MD5_STEPS(MD5_TABLE_SHIFT) };
+
+#undef MD5_TABLE_WORD
+#undef MD5_TABLE_CONSTANT
+#undef MD5_TABLE_SHIFT
+
+static inline uint32_t md5_bswap(uint32_t word) {
+    return __builtin_bswap32(word);
+}
+
+static inline uint32_t md5_rotr(uint32_t word, int shift) {
+    return (word >> shift) | (word << (32 - shift));
+}
+
+/**
+ * @brief The boolean function used by the given step
+ */
+static inline uint32_t md5_step_function(int step, uint32_t x, uint32_t y,
+                                         uint32_t z) {
+    switch (step / 16) {
+        case 0:
+            return z ^ (x & (y ^ z));
+        case 1:
+            return y ^ (z & (x ^ y));
+        case 2:
+            return x ^ y ^ z;
+        default:
+            return y ^ (x | ~z);
+    }
+}
+
+/**
+ * @brief Split a hash as returned by md5s() into the MD5 state words
+ */
+static inline void md5_unpack(uint128_t hash, uint32_t state[4]) {
+    for (int i = 0; i < 4; i++) {
+        uint32_t high_first = (uint32_t)(hash >> (96 - 32 * i));
+        uint32_t low_first = (uint32_t)(hash >> (32 * i));
+
+        switch (md5_layout) {
+            case MD5_LAYOUT_BIG_ENDIAN:
+                state[i] = md5_bswap(high_first);
+                break;
+            case MD5_LAYOUT_LITTLE_ENDIAN:
+                state[i] = low_first;
+                break;
+            case MD5_LAYOUT_RAW:
+            default:
+                state[i] = high_first;
+                break;
+        }
+    }
+}
+
+static inline md5_target_t md5_target(uint128_t hash) {
+    md5_target_t target = { .hash = hash };
+    md5_unpack(hash, target.state);
+
+    return target;
+}
+
+/**
+ * @brief Add a message to the next free lane of the batch. The batch must
+ * either be empty or already contain messages of the same length.
+ */
+static inline void md5_batch_add(md5_batch_t *batch, const char *message,
+                                 int length) {
+    uint8_t block[64] = { 0 };
+
+    memcpy(block, message, length);
+    block[length] = 0x80;
+
+    uint32_t bit_length = (uint32_t)length * 8;
+    memcpy(&block[56], &bit_length, sizeof(bit_length));
+
+    int lane = batch->count;
+    for (int w = 0; w < 16; w++) {
+        uint32_t word;
+        memcpy(&word, &block[w * 4], sizeof(word));
+        batch->words[w][lane] = word;
+    }
+
+    batch->length = length;
+    batch->count++;
+}
+
+/**
+ * @brief Copy the message stored in a lane of the batch into message, which
+ * must have space for batch->length + 1 chars
+ */
+static inline void md5_batch_message(const md5_batch_t *batch, int lane,
+                                     char *message) {
+    for (int i = 0; i < batch->length; i++) {
+        message[i] = (char)(batch->words[i / 4][lane] >> (8 * (i % 4)));
+    }
+
+    message[batch->length] = '\0';
+}
+
+/**
+ * @brief Compare every lane of the batch against the target
+ *
+ * @return A bitmask with bit n set when lane n matches the target
+ */
+static inline uint32_t md5_batch_match(const md5_digests_t *digests, int count,
+                                       const md5_target_t *target) {
+    uint32_t mask = 0;
+
+    for (int lane = 0; lane < MD5_BATCH_LANES; lane++) {
+        bool equal = (digests->state[0][lane] == target->state[0]) &
+                     (digests->state[1][lane] == target->state[1]) &
+                     (digests->state[2][lane] == target->state[2]) &
+                     (digests->state[3][lane] == target->state[3]);
+
+        mask |= (uint32_t)equal << lane;
+    }
+
+    // Lanes past the count contain stale messages
+    return mask & (uint32_t)((1ull << count) - 1);
+}
+
+/**
+ * @brief Fallback kernel which hashes every lane with md5s()
+ */
+static inline void md5_kernel_md5s(const md5_batch_t *batch,
+                                   md5_digests_t *digests) {
+    char message[MD5_BLOCK_MAX_MESSAGE + 1];
+
+    for (int lane = 0; lane < batch->count; lane++) {
+        md5_batch_message(batch, lane, message);
+
+        uint32_t state[4];
+        md5_unpack(md5s(message, batch->length), state);
+
+        for (int i = 0; i < 4; i++) {
+            digests->state[i][lane] = state[i];
+        }
+    }
+}
+
+/**
+ * @brief Prepare a plan for a new target, it is filled in by md5_plan_init()
+ * once the length of the candidates is known
+ */
+static inline void md5_plan_reset(md5_plan_t *plan,
+                                  const md5_target_t *target) {
+    plan->target = *target;
+    plan->length = 0;
+}
+
+/**
+ * @brief Fold the words shared by every lane of the batch into the step
+ * constants and undo the steps at the end of MD5 which only use those words.
+ * The batch must be filled by the candidate generator, or otherwise have the
+ * same padding in every lane.
+ */
+static inline void md5_plan_init(md5_plan_t *plan, const md5_batch_t *batch) {
+    int varying = (batch->length - 1) / 4 + 1;
+
+    // Past 4 words only the final step could be undone, so all words are
+    // loaded from the batch
+    if (varying > 4) {
+        varying = 16;
+    }
+
+    plan->length = batch->length;
+    plan->varying = varying;
+    plan->variant = varying <= 4 ? varying - 1 : 4;
+
+    for (int i = 0; i < 64; i++) {
+        int word = md5_step_word[i];
+
+        plan->constants[i] = md5_step_constant[i];
+        if (word >= varying) {
+            plan->constants[i] += batch->words[word][0];
+        }
+    }
+
+    // Walk back from the target to the state right before the first step that
+    // can be undone. After a step b holds the new word and a, c and d hold the
+    // previous d, b and c.
+    uint32_t a = plan->target.state[0] - MD5_INIT_A;
+    uint32_t b = plan->target.state[1] - MD5_INIT_B;
+    uint32_t c = plan->target.state[2] - MD5_INIT_C;
+    uint32_t d = plan->target.state[3] - MD5_INIT_D;
+
+    for (int i = 63; i >= MD5_FIRST_REVERSED_STEP(varying); i--) {
+        uint32_t previous_b = c;
+        uint32_t previous_c = d;
+        uint32_t previous_d = a;
+
+        uint32_t sum = md5_rotr(b - previous_b, md5_step_shift[i]);
+        a = sum - md5_step_function(i, previous_b, previous_c, previous_d) -
+            plan->constants[i];
+        b = previous_b;
+        c = previous_c;
+        d = previous_d;
+    }
+
+    // a is now the word that was computed by MD5_EARLY_STEP
+    plan->early = a;
+}
+
+/**
+ * @brief Find the lanes of the batch that match the target of the plan,
+ * using the plan kernels when the kernel has them
+ *
+ * @param digests Scratch space for the full digests of the batch
+ * @return A bitmask with bit n set when lane n matches the target
+ */
+static inline uint32_t md5_kernel_search(const md5_kernel_t *kernel,
+                                         md5_plan_t *plan,
+                                         const md5_batch_t *batch,
+                                         md5_digests_t *digests) {
+    if (kernel->plan[0] == NULL) {
+        kernel->hash(batch, digests);
+
+        return md5_batch_match(digests, batch->count, &plan->target);
+    }
+
+    if (plan->length != batch->length) {
+        md5_plan_init(plan, batch);
+    }
+
+    uint32_t candidates = kernel->plan[plan->variant](batch, plan);
+
+    if (candidates == 0) {
+        return 0;
+    }
+
+    // Only one state word was compared so rule out false positives
+    kernel->hash(batch, digests);
+
+    return md5_batch_match(digests, batch->count, &plan->target) & candidates;
+}
+
+/**
+ * @brief One step of a plan kernel. Steps past MD5_EARLY_STEP are skipped and
+ * fixed words come from the folded constants instead of the batch. varying is a
+ * compile time constant in every variant, so all of the branches fold away.
+ */
+#define MD5_PLAN_STEP(i, f, a, b, c, d, w, k, s)          \
+    if ((i) <= MD5_EARLY_STEP(varying)) {                 \
+        __typeof__(a) word = SET1(plan->constants[i]);    \
+        if ((w) < varying) {                              \
+            word = ADD(word, LOAD(w));                    \
+        }                                                 \
+        a = ADD(a, ADD(MD5_##f(b, c, d), word));          \
+        a = ADD(b, ROTL(a, s));                           \
+        if ((i) == MD5_EARLY_STEP(varying)) {             \
+            early = a;                                    \
+        }                                                 \
+    }
+
+// Defines the variants of a plan kernel for 1, 2, 3, 4 and 16 varying words
+#define MD5_PLAN_VARIANT_FUNCTIONS(name, attributes)                        \
+    attributes static uint32_t name##_1(const md5_batch_t *batch,          \
+                                        const md5_plan_t *plan) {          \
+        return name(batch, plan, 1);                                        \
+    }                                                                       \
+    attributes static uint32_t name##_2(const md5_batch_t *batch,          \
+                                        const md5_plan_t *plan) {          \
+        return name(batch, plan, 2);                                        \
+    }                                                                       \
+    attributes static uint32_t name##_3(const md5_batch_t *batch,          \
+                                        const md5_plan_t *plan) {          \
+        return name(batch, plan, 3);                                        \
+    }                                                                       \
+    attributes static uint32_t name##_4(const md5_batch_t *batch,          \
+                                        const md5_plan_t *plan) {          \
+        return name(batch, plan, 4);                                        \
+    }                                                                       \
+    attributes static uint32_t name##_16(const md5_batch_t *batch,         \
+                                         const md5_plan_t *plan) {         \
+        return name(batch, plan, 16);                                       \
+    }
+
+#define MD5_PLAN_VARIANTS_OF(name) \
+    { name##_1, name##_2, name##_3, name##_4, name##_16 }
+
+// Boolean functions of each round, shared by all kernels
+#define MD5_F(x, y, z) XOR(z, AND(x, XOR(y, z)))
+#define MD5_G(x, y, z) XOR(y, AND(z, XOR(x, y)))
+#define MD5_H(x, y, z) XOR(XOR(x, y), z)
+#define MD5_I(x, y, z) XOR(y, OR(x, NOT(z)))
+
+#define MD5_VECTOR_STEP(i, f, a, b, c, d, w, k, s)            \
+    a = ADD(a, ADD(MD5_##f(b, c, d), ADD(SET1(k), LOAD(w)))); \
+    a = ADD(b, ROTL(a, s));
+
+/* Scalar: one lane at a time, for CPUs without AVX2 */
+
+#define ADD(x, y) ((x) + (y))
+#define AND(x, y) ((x) & (y))
+#define OR(x, y) ((x) | (y))
+#define XOR(x, y) ((x) ^ (y))
+#define NOT(x) (~(x))
+#define SET1(k) ((uint32_t)(k))
+#define ROTL(x, s) (((x) << (s)) | ((x) >> (32 - (s))))
+#define LOAD(w) (batch->words[w][lane])
+
+static inline __attribute__((always_inline)) uint32_t
+md5_plan_scalar(const md5_batch_t *batch, const md5_plan_t *plan,
+                const int varying) {
+    uint32_t mask = 0;
+
+    for (int lane = 0; lane < batch->count; lane++) {
+        uint32_t a = MD5_INIT_A;
+        uint32_t b = MD5_INIT_B;
+        uint32_t c = MD5_INIT_C;
+        uint32_t d = MD5_INIT_D;
+        uint32_t early = 0;
+
+        MD5_STEPS(MD5_PLAN_STEP)
+
+        mask |= (uint32_t)(early == plan->early) << lane;
+    }
+
+    return mask;
+}
+
+MD5_PLAN_VARIANT_FUNCTIONS(md5_plan_scalar, )
+
+#undef ADD
+#undef AND
+#undef OR
+#undef XOR
+#undef NOT
+#undef SET1
+#undef ROTL
+#undef LOAD
+
+/* AVX2: 8 lanes per pass */
+
+#define ADD(x, y) _mm256_add_epi32(x, y)
+#define AND(x, y) _mm256_and_si256(x, y)
+#define OR(x, y) _mm256_or_si256(x, y)
+#define XOR(x, y) _mm256_xor_si256(x, y)
+#define NOT(x) _mm256_xor_si256(x, _mm256_set1_epi32(-1))
+#define SET1(k) _mm256_set1_epi32((int)(k))
+#define ROTL(x, s) \
+    _mm256_or_si256(_mm256_slli_epi32(x, s), _mm256_srli_epi32(x, 32 - (s)))
+#define LOAD(w) \
+    _mm256_loadu_si256((const __m256i *)&batch->words[w][offset])
+
+__attribute__((target("avx2"))) static void
+md5_kernel_avx2(const md5_batch_t *batch, md5_digests_t *digests) {
+    for (int offset = 0; offset < batch->count; offset += 8) {
+        __m256i a = SET1(MD5_INIT_A);
+        __m256i b = SET1(MD5_INIT_B);
+        __m256i c = SET1(MD5_INIT_C);
+        __m256i d = SET1(MD5_INIT_D);
+
+        MD5_STEPS(MD5_VECTOR_STEP)
+
+        a = ADD(a, SET1(MD5_INIT_A));
+        b = ADD(b, SET1(MD5_INIT_B));
+        c = ADD(c, SET1(MD5_INIT_C));
+        d = ADD(d, SET1(MD5_INIT_D));
+
+        _mm256_storeu_si256((__m256i *)&digests->state[0][offset], a);
+        _mm256_storeu_si256((__m256i *)&digests->state[1][offset], b);
+        _mm256_storeu_si256((__m256i *)&digests->state[2][offset], c);
+        _mm256_storeu_si256((__m256i *)&digests->state[3][offset], d);
+    }
+}
+
+__attribute__((target("avx2"), always_inline)) static inline uint32_t
+md5_plan_avx2(const md5_batch_t *batch, const md5_plan_t *plan,
+              const int varying) {
+    uint32_t mask = 0;
+
+    for (int offset = 0; offset < batch->count; offset += 8) {
+        __m256i a = SET1(MD5_INIT_A);
+        __m256i b = SET1(MD5_INIT_B);
+        __m256i c = SET1(MD5_INIT_C);
+        __m256i d = SET1(MD5_INIT_D);
+        __m256i early = a;
+
+        MD5_STEPS(MD5_PLAN_STEP)
+
+        __m256i equal = _mm256_cmpeq_epi32(early, SET1(plan->early));
+        uint32_t lanes = _mm256_movemask_ps(_mm256_castsi256_ps(equal));
+
+        mask |= lanes << offset;
+    }
+
+    // Lanes past the count contain stale messages
+    return mask & (uint32_t)((1ull << batch->count) - 1);
+}
+
+MD5_PLAN_VARIANT_FUNCTIONS(md5_plan_avx2, __attribute__((target("avx2"))))
+
+#undef ADD
+#undef AND
+#undef OR
+#undef XOR
+#undef NOT
+#undef SET1
+#undef ROTL
+#undef LOAD
+
+/* AVX-512: all 16 lanes in one pass */
+
+#define ADD(x, y) _mm512_add_epi32(x, y)
+#define AND(x, y) _mm512_and_si512(x, y)
+#define OR(x, y) _mm512_or_si512(x, y)
+#define XOR(x, y) _mm512_xor_si512(x, y)
+#define NOT(x) _mm512_xor_si512(x, _mm512_set1_epi32(-1))
+#define SET1(k) _mm512_set1_epi32((int)(k))
+#define ROTL(x, s) _mm512_rol_epi32(x, s)
+#define LOAD(w) _mm512_loadu_si512((const void *)&batch->words[w][0])
+
+// The ternary logic instruction evaluates each round function in one go
+#undef MD5_F
+#undef MD5_G
+#undef MD5_H
+#undef MD5_I
+#define MD5_F(x, y, z) _mm512_ternarylogic_epi32(x, y, z, 0xca)
+#define MD5_G(x, y, z) _mm512_ternarylogic_epi32(x, y, z, 0xe4)
+#define MD5_H(x, y, z) _mm512_ternarylogic_epi32(x, y, z, 0x96)
+#define MD5_I(x, y, z) _mm512_ternarylogic_epi32(x, y, z, 0x39)
+
+__attribute__((target("avx512f"))) static void
+md5_kernel_avx512(const md5_batch_t *batch, md5_digests_t *digests) {
+    __m512i a = SET1(MD5_INIT_A);
+    __m512i b = SET1(MD5_INIT_B);
+    __m512i c = SET1(MD5_INIT_C);
+    __m512i d = SET1(MD5_INIT_D);
+
+    MD5_STEPS(MD5_VECTOR_STEP)
+
+    a = ADD(a, SET1(MD5_INIT_A));
+    b = ADD(b, SET1(MD5_INIT_B));
+    c = ADD(c, SET1(MD5_INIT_C));
+    d = ADD(d, SET1(MD5_INIT_D));
+
+    _mm512_storeu_si512((void *)&digests->state[0][0], a);
+    _mm512_storeu_si512((void *)&digests->state[1][0], b);
+    _mm512_storeu_si512((void *)&digests->state[2][0], c);
+    _mm512_storeu_si512((void *)&digests->state[3][0], d);
+}
+
+__attribute__((target("avx512f"), always_inline)) static inline uint32_t
+md5_plan_avx512(const md5_batch_t *batch, const md5_plan_t *plan,
+                const int varying) {
+    __m512i a = SET1(MD5_INIT_A);
+    __m512i b = SET1(MD5_INIT_B);
+    __m512i c = SET1(MD5_INIT_C);
+    __m512i d = SET1(MD5_INIT_D);
+    __m512i early = a;
+
+    MD5_STEPS(MD5_PLAN_STEP)
+
+    uint32_t mask = _mm512_cmpeq_epi32_mask(early, SET1(plan->early));
+
+    // Lanes past the count contain stale messages
+    return mask & (uint32_t)((1ull << batch->count) - 1);
+}
+
+MD5_PLAN_VARIANT_FUNCTIONS(md5_plan_avx512,
+                           __attribute__((target("avx512f"))))
+
+#undef ADD
+#undef AND
+#undef OR
+#undef XOR
+#undef NOT
+#undef SET1
+#undef ROTL
+#undef LOAD
+#undef MD5_F
+#undef MD5_G
+#undef MD5_H
+#undef MD5_I
+#undef MD5_VECTOR_STEP
+#undef MD5_PLAN_STEP
+#undef MD5_PLAN_VARIANT_FUNCTIONS
+
+/**
+ * @brief Find out how md5s() packs its digest by hashing the empty message,
+ * whose digest is d41d8cd98f00b204e9800998ecf8427e
+ */
+static inline md5_layout_t md5_detect_layout(void) {
+    uint128_t empty = md5s("", 0);
+
+    if (empty == UINT128(0xd41d8cd98f00b204, 0xe9800998ecf8427e)) {
+        return MD5_LAYOUT_BIG_ENDIAN;
+    }
+
+    if (empty == UINT128(0x7e42f8ec980980e9, 0x04b2008fd98c1dd4)) {
+        return MD5_LAYOUT_LITTLE_ENDIAN;
+    }
+
+    return MD5_LAYOUT_RAW;
+}
+
+/**
+ * @brief Check a kernel against md5s(), both hashing full batches and
+ * searching them with a plan for every plan variant
+ */
+static inline bool md5_kernel_verify(md5_kernel_t kernel) {
+    static const int lengths[] = { 3, 7, 11, 15, 20 };
+    char message[MD5_BLOCK_MAX_MESSAGE + 1];
+
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        int length = lengths[i];
+        md5_batch_t batch = { .count = 0 };
+
+        memset(message, 'q', length);
+        while (batch.count < MD5_BATCH_LANES) {
+            message[0] = (char)('a' + batch.count);
+            message[length - 1] = (char)('A' + batch.count);
+            md5_batch_add(&batch, message, length);
+        }
+
+        md5_digests_t digests;
+        kernel.hash(&batch, &digests);
+
+        for (int lane = 0; lane < batch.count; lane++) {
+            md5_batch_message(&batch, lane, message);
+            md5_target_t target = md5_target(md5s(message, length));
+
+            for (int w = 0; w < 4; w++) {
+                if (digests.state[w][lane] != target.state[w]) {
+                    return false;
+                }
+            }
+        }
+
+        if (kernel.plan[0] == NULL) {
+            continue;
+        }
+
+        int expected_lane = (int)i + 5;
+        md5_batch_message(&batch, expected_lane, message);
+        md5_target_t target = md5_target(md5s(message, length));
+
+        md5_plan_t plan;
+        md5_plan_reset(&plan, &target);
+
+        if (md5_kernel_search(&kernel, &plan, &batch, &digests) !=
+            1u << expected_lane) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Pick the widest kernel this CPU supports. The vector and plan kernels
+ * are only used when md5s() produces plain MD5 digests in a known layout.
+ */
+static inline md5_kernel_t md5_kernel_select(void) {
+    md5_kernel_t fallback = { .name = "md5s", .hash = md5_kernel_md5s };
+
+    md5_layout = md5_detect_layout();
+
+    if (md5_layout == MD5_LAYOUT_RAW) {
+        return fallback;
+    }
+
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f")) {
+        md5_kernel_t kernel = {
+            .name = "avx512",
+            .hash = md5_kernel_avx512,
+            .plan = MD5_PLAN_VARIANTS_OF(md5_plan_avx512),
+        };
+
+        if (md5_kernel_verify(kernel)) {
+            return kernel;
+        }
+    }
+
+    if (__builtin_cpu_supports("avx2")) {
+        md5_kernel_t kernel = {
+            .name = "avx2",
+            .hash = md5_kernel_avx2,
+            .plan = MD5_PLAN_VARIANTS_OF(md5_plan_avx2),
+        };
+
+        if (md5_kernel_verify(kernel)) {
+            return kernel;
+        }
+    }
+
+    md5_kernel_t scalar = {
+        .name = "scalar",
+        .hash = md5_kernel_md5s,
+        .plan = MD5_PLAN_VARIANTS_OF(md5_plan_scalar),
+    };
+
+    if (md5_kernel_verify(scalar)) {
+        return scalar;
+    }
+
+    return fallback;
+}
+
+#endif // MD5_KERNEL_H_
@@ -0,0 +1,686 @@
+/*
+ * Operating Systems (2INCO) Practical Assignment
+ * Interprocess Communication
+ *
+ * Zachary Kohnen (1655221)
+ *
+ * Message queues used between the farmer and the workers. A queue is either a
+ * POSIX message queue, or a lock-free ring buffer in a shared memory segment
+ * which only enters the kernel to sleep when the ring is empty or full.
+ *
+ * The functions follow the conventions of their mq_* counterparts: they return
+ * -1 and set errno on failure.
+ *
+ */
+
+#ifndef QUEUE_H_
+#define QUEUE_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <mqueue.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CACHE_LINE_SIZE 64
+
+typedef enum {
+    QUEUE_MQ, // POSIX message queue
+    QUEUE_SHM, // Ring buffer in shared memory
+} queue_backend_t;
+
+/**
+ * @brief A cell of the ring. The sequence tells producers and consumers whose
+ * turn it is to use the cell, as in Dmitry Vyukov's bounded MPMC queue.
+ */
+typedef struct {
+    _Atomic uint32_t sequence;
+    unsigned char message[];
+} ring_cell_t;
+
+/**
+ * @brief Header of the shared memory segment, followed by the cells. The
+ * positions only ever grow and are masked to find the cell.
+ */
+typedef struct {
+    uint32_t capacity; // Amount of cells, always a power of 2
+    uint32_t cell_size; // Size of a cell including the message
+    uint32_t message_size;
+
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t enqueue_position;
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t dequeue_position;
+
+    // Futex words, bumped after every push and pop, with the amount of
+    // processes sleeping on them so that nobody is woken needlessly
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t pushes;
+    _Atomic uint32_t push_sleepers;
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t pops;
+    _Atomic uint32_t pop_sleepers;
+
+    _Alignas(CACHE_LINE_SIZE) unsigned char cells[];
+} ring_t;
+
+typedef struct {
+    queue_backend_t backend;
+    size_t message_size;
+
+    mqd_t mq;
+
+    ring_t *ring;
+    size_t ring_size; // Size of the mapping
+} queue_t;
+
+static inline ring_cell_t *ring_cell(ring_t *ring, uint32_t position) {
+    size_t index = position & (ring->capacity - 1);
+
+    return (ring_cell_t *)&ring->cells[index * ring->cell_size];
+}
+
+static inline size_t ring_size(uint32_t capacity, size_t message_size,
+                               uint32_t *cell_size) {
+    size_t cell = sizeof(ring_cell_t) + message_size;
+
+    // Keep every sequence number aligned
+    cell = (cell + _Alignof(ring_cell_t) - 1) & ~(_Alignof(ring_cell_t) - 1);
+
+    if (cell_size != NULL) {
+        *cell_size = (uint32_t)cell;
+    }
+
+    return sizeof(ring_t) + cell * capacity;
+}
+
+static inline void futex_wait(_Atomic uint32_t *word, uint32_t expected) {
+    // The mapping is shared between processes, so no FUTEX_PRIVATE_FLAG
+    syscall(SYS_futex, word, FUTEX_WAIT, expected, NULL, NULL, 0);
+}
+
+static inline void futex_wake(_Atomic uint32_t *word, int count) {
+    syscall(SYS_futex, word, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+/**
+ * @brief Bump the futex word and wake one of the processes sleeping on it.
+ * Every push or pop lets at most one sleeper make progress, and a sleeper that
+ * loses the race for it reads the word again before going back to sleep.
+ */
+static inline void ring_notify(_Atomic uint32_t *word,
+                               _Atomic uint32_t *sleepers) {
+    atomic_fetch_add(word, 1);
+
+    if (atomic_load(sleepers) != 0) {
+        futex_wake(word, 1);
+    }
+}
+
+/**
+ * @brief Try to push a message without blocking
+ *
+ * @return false if the ring is full
+ */
+static inline bool ring_try_push(ring_t *ring, const void *message) {
+    uint32_t position = atomic_load_explicit(&ring->enqueue_position,
+                                             memory_order_relaxed);
+
+    while (true) {
+        ring_cell_t *cell = ring_cell(ring, position);
+        uint32_t sequence = atomic_load_explicit(&cell->sequence,
+                                                 memory_order_acquire);
+        int32_t difference = (int32_t)(sequence - position);
+
+        if (difference == 0) {
+            // The cell is free, claim it by moving the position past it
+            if (atomic_compare_exchange_weak_explicit(
+                    &ring->enqueue_position, &position, position + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                memcpy(cell->message, message, ring->message_size);
+                atomic_store_explicit(&cell->sequence, position + 1,
+                                      memory_order_release);
+
+                ring_notify(&ring->pushes, &ring->push_sleepers);
+                return true;
+            }
+        } else if (difference < 0) {
+            // The cell still holds a message from the previous lap
+            return false;
+        } else {
+            position = atomic_load_explicit(&ring->enqueue_position,
+                                            memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * @brief Try to pop a message without blocking
+ *
+ * @return false if the ring is empty
+ */
+static inline bool ring_try_pop(ring_t *ring, void *message) {
+    uint32_t position = atomic_load_explicit(&ring->dequeue_position,
+                                             memory_order_relaxed);
+
+    while (true) {
+        ring_cell_t *cell = ring_cell(ring, position);
+        uint32_t sequence = atomic_load_explicit(&cell->sequence,
+                                                 memory_order_acquire);
+        int32_t difference = (int32_t)(sequence - (position + 1));
+
+        if (difference == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &ring->dequeue_position, &position, position + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                memcpy(message, cell->message, ring->message_size);
+
+                // Hand the cell to the producers of the next lap
+                atomic_store_explicit(&cell->sequence,
+                                      position + ring->capacity,
+                                      memory_order_release);
+
+                ring_notify(&ring->pops, &ring->pop_sleepers);
+                return true;
+            }
+        } else if (difference < 0) {
+            // The ring is empty, or the producer of this cell has not
+            // finished writing it yet
+            return false;
+        } else {
+            position = atomic_load_explicit(&ring->dequeue_position,
+                                            memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * @brief Check if a push would find a free cell, without claiming it
+ */
+static inline bool ring_has_space(ring_t *ring) {
+    uint32_t position = atomic_load(&ring->enqueue_position);
+
+    return atomic_load(&ring_cell(ring, position)->sequence) == position;
+}
+
+/**
+ * @brief Check if a pop would find a message, without taking it
+ */
+static inline bool ring_has_message(ring_t *ring) {
+    uint32_t position = atomic_load(&ring->dequeue_position);
+
+    return atomic_load(&ring_cell(ring, position)->sequence) == position + 1;
+}
+
+/**
+ * @brief Run the operation until it succeeds, sleeping on the futex word in
+ * between attempts. The word is read before every attempt, so a notification
+ * that arrives after a failed attempt makes the futex return immediately.
+ */
+#define RING_BLOCKING(operation, word, sleepers)                   \
+    while (true) {                                                 \
+        uint32_t seen = atomic_load(word);                         \
+                                                                   \
+        if (operation) {                                           \
+            break;                                                 \
+        }                                                          \
+                                                                   \
+        atomic_fetch_add(sleepers, 1);                             \
+        futex_wait(word, seen);                                    \
+        atomic_fetch_sub(sleepers, 1);                             \
+    }
+
+/**
+ * @brief Create a new queue, failing if it already exists
+ *
+ * @param capacity The most messages the queue can hold. Rings round this up
+ * to a power of 2.
+ * @param flags O_RDONLY or O_WRONLY, for message queues
+ * @return 0 on success, -1 on failure
+ */
+static inline int queue_create(queue_t *queue, queue_backend_t backend,
+                               const char *name, size_t message_size,
+                               long capacity, int flags) {
+    queue->backend = backend;
+    queue->message_size = message_size;
+
+    if (backend == QUEUE_MQ) {
+        queue->mq = mq_open(name, flags | O_CREAT | O_EXCL, 0600,
+                            &((struct mq_attr){
+                                .mq_msgsize = message_size,
+                                .mq_maxmsg = capacity,
+                            }));
+
+        return queue->mq == -1 ? -1 : 0;
+    }
+
+    // The sequence numbers can not tell a full cell from a free one with a
+    // single cell, so a ring has at least two
+    uint32_t cells = 2;
+    while (cells < capacity) {
+        cells *= 2;
+    }
+
+    uint32_t cell_size;
+    size_t size = ring_size(cells, message_size, &cell_size);
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+    if (fd == -1) {
+        return -1;
+    }
+
+    if (ftruncate(fd, size) == -1) {
+        int error = errno;
+        close(fd);
+        shm_unlink(name);
+        errno = error;
+        return -1;
+    }
+
+    ring_t *ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                        0);
+    close(fd);
+
+    if (ring == MAP_FAILED) {
+        int error = errno;
+        shm_unlink(name);
+        errno = error;
+        return -1;
+    }
+
+    // The segment starts out zeroed, so only the header and the sequences of
+    // the cells need to be written
+    ring->capacity = cells;
+    ring->cell_size = cell_size;
+    ring->message_size = message_size;
+
+    for (uint32_t i = 0; i < cells; i++) {
+        atomic_init(&ring_cell(ring, i)->sequence, i);
+    }
+
+    queue->ring = ring;
+    queue->ring_size = size;
+
+    return 0;
+}
+
+/**
+ * @brief Open a queue made by queue_create()
+ *
+ * @return 0 on success, -1 on failure
+ */
+static inline int queue_open(queue_t *queue, queue_backend_t backend,
+                             const char *name, size_t message_size,
+                             int flags) {
+    queue->backend = backend;
+    queue->message_size = message_size;
+
+    if (backend == QUEUE_MQ) {
+        queue->mq = mq_open(name, flags);
+
+        return queue->mq == -1 ? -1 : 0;
+    }
+
+    int fd = shm_open(name, O_RDWR, 0);
+
+    if (fd == -1) {
+        return -1;
+    }
+
+    ring_t header;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (header.message_size != message_size) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t size = ring_size(header.capacity, message_size, NULL);
+    ring_t *ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                        0);
+    close(fd);
+
+    if (ring == MAP_FAILED) {
+        return -1;
+    }
+
+    queue->ring = ring;
+    queue->ring_size = size;
+
+    return 0;
+}
+
+/**
+ * @brief Send a message, blocking while the queue is full
+ *
+ * @return 0 on success, -1 on failure
+ */
+static inline int queue_send(queue_t *queue, const void *message) {
+    if (queue->backend == QUEUE_MQ) {
+        return mq_send(queue->mq, message, queue->message_size, 0);
+    }
+
+    ring_t *ring = queue->ring;
+    RING_BLOCKING(ring_try_push(ring, message), &ring->pops,
+                  &ring->pop_sleepers);
+
+    return 0;
+}
+
+/**
+ * @brief Receive a message, blocking while the queue is empty
+ *
+ * @return The size of the message, or -1 on failure
+ */
+static inline ssize_t queue_receive(queue_t *queue, void *message) {
+    if (queue->backend == QUEUE_MQ) {
+        return mq_receive(queue->mq, message, queue->message_size, NULL);
+    }
+
+    ring_t *ring = queue->ring;
+    RING_BLOCKING(ring_try_pop(ring, message), &ring->pushes,
+                  &ring->push_sleepers);
+
+    return queue->message_size;
+}
+
+// A timeout in the past, which makes the timed mq calls return immediately
+static const struct timespec queue_no_wait = { 0 };
+
+/**
+ * @brief Send a message if the queue has space for it
+ *
+ * @return 0 on success, -1 on failure with errno set to EAGAIN if the queue
+ * is full
+ */
+static inline int queue_try_send(queue_t *queue, const void *message) {
+    if (queue->backend == QUEUE_MQ) {
+        int status = mq_timedsend(queue->mq, message, queue->message_size, 0,
+                                  &queue_no_wait);
+
+        if (status == -1 && errno == ETIMEDOUT) {
+            errno = EAGAIN;
+        }
+
+        return status;
+    }
+
+    if (!ring_try_push(queue->ring, message)) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Receive a message if there is one
+ *
+ * @return The size of the message, or -1 on failure with errno set to EAGAIN
+ * if the queue is empty
+ */
+static inline ssize_t queue_try_receive(queue_t *queue, void *message) {
+    if (queue->backend == QUEUE_MQ) {
+        ssize_t size = mq_timedreceive(queue->mq, message,
+                                       queue->message_size, NULL,
+                                       &queue_no_wait);
+
+        if (size == -1 && errno == ETIMEDOUT) {
+            errno = EAGAIN;
+        }
+
+        return size;
+    }
+
+    if (!ring_try_pop(queue->ring, message)) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    return queue->message_size;
+}
+
+/**
+ * @brief The most messages the queue can hold
+ *
+ * @return The capacity, or -1 on failure
+ */
+static inline long queue_capacity(queue_t *queue) {
+    if (queue->backend == QUEUE_MQ) {
+        struct mq_attr attributes;
+
+        if (mq_getattr(queue->mq, &attributes) == -1) {
+            return -1;
+        }
+
+        return attributes.mq_maxmsg;
+    }
+
+    return queue->ring->capacity;
+}
+
+/**
+ * @brief The amount of messages waiting in the queue
+ *
+ * @return The amount, or -1 on failure
+ */
+static inline long queue_pending(queue_t *queue) {
+    if (queue->backend == QUEUE_MQ) {
+        struct mq_attr attributes;
+
+        if (mq_getattr(queue->mq, &attributes) == -1) {
+            return -1;
+        }
+
+        return attributes.mq_curmsgs;
+    }
+
+    return (uint32_t)(atomic_load(&queue->ring->enqueue_position) -
+                      atomic_load(&queue->ring->dequeue_position));
+}
+
+/**
+ * @brief Close the handle to the queue, the queue itself stays around until
+ * it is unlinked
+ *
+ * @return 0 on success, -1 on failure
+ */
+static inline int queue_close(queue_t *queue) {
+    if (queue->backend == QUEUE_MQ) {
+        return mq_close(queue->mq);
+    }
+
+    return munmap(queue->ring, queue->ring_size);
+}
+
+/**
+ * @brief Remove the queue with the given name
+ *
+ * @return 0 on success, -1 on failure
+ */
+static inline int queue_unlink(queue_backend_t backend, const char *name) {
+    if (backend == QUEUE_MQ) {
+        return mq_unlink(name);
+    }
+
+    return shm_unlink(name);
+}
+
+/**
+ * @brief Lets a single process wait until it can send on one queue or receive
+ * on another, instead of polling both. Both queues must use the same backend.
+ */
+typedef struct {
+    queue_t *send_queue;
+    queue_t *receive_queue;
+
+    int epoll; // For message queues, which are file descriptors on Linux
+    uint32_t send_events; // The events currently registered for send_queue
+} queue_waiter_t;
+
+/**
+ * @return 0 on success, -1 on failure
+ */
+static inline int queue_waiter_init(queue_waiter_t *waiter,
+                                    queue_t *send_queue,
+                                    queue_t *receive_queue) {
+    waiter->send_queue = send_queue;
+    waiter->receive_queue = receive_queue;
+    waiter->epoll = -1;
+    waiter->send_events = EPOLLOUT;
+
+    if (send_queue->backend != QUEUE_MQ) {
+        return 0;
+    }
+
+    waiter->epoll = epoll_create1(EPOLL_CLOEXEC);
+
+    if (waiter->epoll == -1) {
+        return -1;
+    }
+
+    struct epoll_event send_event = { .events = EPOLLOUT, .data.u32 = 0 };
+    struct epoll_event receive_event = { .events = EPOLLIN, .data.u32 = 1 };
+
+    if (epoll_ctl(waiter->epoll, EPOLL_CTL_ADD, send_queue->mq,
+                  &send_event) == -1 ||
+        epoll_ctl(waiter->epoll, EPOLL_CTL_ADD, receive_queue->mq,
+                  &receive_event) == -1) {
+        int error = errno;
+        close(waiter->epoll);
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Sleep until the send queue has space, if want_send is set, or until
+ * the receive queue has a message. Returns immediately if that is already the
+ * case, so it can be called whenever the caller ran out of work.
+ *
+ * @param timeout The longest time to sleep, or NULL to sleep for as long as
+ * it takes
+ * @return 0 on success, also when the timeout passed, -1 on failure
+ */
+static inline int queue_wait(queue_waiter_t *waiter, bool want_send,
+                             const struct timespec *timeout) {
+    if (waiter->epoll != -1) {
+        // Stop listening for space once there is nothing left to send, or
+        // epoll would keep returning straight away
+        uint32_t send_events = want_send ? EPOLLOUT : 0;
+
+        if (send_events != waiter->send_events) {
+            struct epoll_event event = { .events = send_events,
+                                         .data.u32 = 0 };
+
+            if (epoll_ctl(waiter->epoll, EPOLL_CTL_MOD,
+                          waiter->send_queue->mq, &event) == -1) {
+                return -1;
+            }
+
+            waiter->send_events = send_events;
+        }
+
+        // Round up, so that the caller does not wake up just too early
+        int milliseconds = timeout == NULL
+                               ? -1
+                               : (int)(timeout->tv_sec * 1000 +
+                                       (timeout->tv_nsec + 999999) / 1000000);
+
+        struct epoll_event events[2];
+        int ready = epoll_wait(waiter->epoll, events, 2, milliseconds);
+
+        return ready == -1 && errno != EINTR ? -1 : 0;
+    }
+
+    ring_t *send_ring = waiter->send_queue->ring;
+    ring_t *receive_ring = waiter->receive_queue->ring;
+
+    // Read the futex words before checking the rings, a push or pop after
+    // the check then changes them and the wait returns immediately
+    uint32_t seen_pops = atomic_load(&send_ring->pops);
+    uint32_t seen_pushes = atomic_load(&receive_ring->pushes);
+
+    if ((want_send && ring_has_space(send_ring)) ||
+        ring_has_message(receive_ring)) {
+        return 0;
+    }
+
+    struct futex_waitv waiters[2] = {
+        {
+            .val = seen_pushes,
+            .uaddr = (uintptr_t)&receive_ring->pushes,
+            .flags = FUTEX_32,
+        },
+        {
+            .val = seen_pops,
+            .uaddr = (uintptr_t)&send_ring->pops,
+            .flags = FUTEX_32,
+        },
+    };
+
+    // futex_waitv() takes the time to wake up at instead of a timeout
+    struct timespec deadline;
+
+    if (timeout != NULL) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout->tv_sec;
+        deadline.tv_nsec += timeout->tv_nsec;
+
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    atomic_fetch_add(&receive_ring->push_sleepers, 1);
+    if (want_send) {
+        atomic_fetch_add(&send_ring->pop_sleepers, 1);
+    }
+
+    long status = syscall(SYS_futex_waitv, waiters, want_send ? 2 : 1, 0,
+                          timeout == NULL ? NULL : &deadline,
+                          CLOCK_MONOTONIC);
+
+    // Kernels before 5.16 cannot wait on both words, so only wait for a
+    // response and check for space again after a short while
+    if (status == -1 && errno == ENOSYS) {
+        struct timespec short_timeout = { .tv_nsec = 1000000 };
+        const struct timespec *fallback_timeout = timeout;
+
+        if (want_send && (timeout == NULL || timeout->tv_sec > 0 ||
+                          timeout->tv_nsec > short_timeout.tv_nsec)) {
+            fallback_timeout = &short_timeout;
+        }
+
+        syscall(SYS_futex, &receive_ring->pushes, FUTEX_WAIT, seen_pushes,
+                fallback_timeout, NULL, 0);
+    }
+
+    atomic_fetch_sub(&receive_ring->push_sleepers, 1);
+    if (want_send) {
+        atomic_fetch_sub(&send_ring->pop_sleepers, 1);
+    }
+
+    return 0;
+}
+
+static inline void queue_waiter_close(queue_waiter_t *waiter) {
+    if (waiter->epoll != -1) {
+        close(waiter->epoll);
+    }
+}
+
+#endif // QUEUE_H_
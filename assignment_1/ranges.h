@@ -0,0 +1,236 @@
+/*
+ * Operating Systems (2INCO) Practical Assignment
+ * Interprocess Communication
+ *
+ * Zachary Kohnen (1655221)
+ *
+ * The range board shared by the workers through shared memory. Every worker
+ * publishes the keyspace range it is working on in its own slot and claims
+ * candidates from it a piece at a time, so that idle workers can split off
+ * and steal the unclaimed part of a long-running range.
+ *
+ */
+
+#ifndef RANGES_H_
+#define RANGES_H_
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "common.h"
+
+/**
+ * @brief The range a worker is working on. The owner claims candidates by
+ * moving cursor up without the lock, thieves split the range by moving end
+ * down with the lock held.
+ */
+typedef struct {
+    _Alignas(64) atomic_flag lock; // Held while the job is replaced or split
+    job_t job; // The job the range belongs to
+    _Atomic uint64_t cursor; // The index of the first unclaimed candidate
+    _Atomic uint64_t end; // One past the index of the last candidate
+} range_slot_t;
+
+// The range board as it is laid out in the shared memory segment
+typedef struct {
+    int count;
+    range_slot_t slots[];
+} range_board_t;
+
+static inline size_t range_board_size(int count) {
+    return sizeof(range_board_t) + sizeof(range_slot_t) * (size_t)count;
+}
+
+static inline void range_slot_lock(range_slot_t *slot) {
+    while (atomic_flag_test_and_set_explicit(&slot->lock,
+                                             memory_order_acquire)) {
+    }
+}
+
+static inline void range_slot_unlock(range_slot_t *slot) {
+    atomic_flag_clear_explicit(&slot->lock, memory_order_release);
+}
+
+/**
+ * @brief Initialize a slot that is not on a board, for workers that do not
+ * share their work
+ */
+static inline void range_slot_init(range_slot_t *slot) {
+    atomic_flag_clear(&slot->lock);
+    atomic_init(&slot->cursor, 0);
+    atomic_init(&slot->end, 0);
+}
+
+/**
+ * @brief Make the range of the job the one the slot hands out
+ */
+static inline void range_publish(range_slot_t *slot, const job_t *job) {
+    range_slot_lock(slot);
+
+    slot->job = *job;
+    atomic_store(&slot->cursor, job->start);
+    atomic_store(&slot->end, job->end);
+
+    range_slot_unlock(slot);
+}
+
+/**
+ * @brief Stop handing out the rest of the range, so that no worker steals
+ * from a job that was abandoned
+ *
+ * @return The end of the range after all steals from it, or 0 if it was
+ * already retired
+ */
+static inline uint64_t range_retire(range_slot_t *slot) {
+    range_slot_lock(slot);
+    uint64_t end = atomic_exchange(&slot->end, 0);
+    range_slot_unlock(slot);
+
+    return end;
+}
+
+/**
+ * @brief Claim at most size candidates from the start of the range
+ *
+ * @return false once the range is exhausted
+ */
+static inline bool range_claim(range_slot_t *slot, uint64_t size,
+                               uint64_t *first, uint64_t *last) {
+    uint64_t cursor = atomic_fetch_add(&slot->cursor, size);
+    uint64_t end = atomic_load(&slot->end);
+
+    if (cursor >= end) {
+        return false;
+    }
+
+    *first = cursor;
+    *last = end - cursor < size ? end : cursor + size;
+
+    return true;
+}
+
+/**
+ * @brief Split the slot with the most unclaimed candidates in two and take
+ * the upper half as a job of its own. A claim racing the split can hash a few
+ * candidates of the stolen half as well, which is harmless since the farmer
+ * ignores repeated matches.
+ *
+ * @param self The slot of the thief, which is never stolen from
+ * @param min_size Only split ranges with at least this many candidates left
+ * @return false if no range was worth splitting
+ */
+static inline bool range_steal(range_board_t *board, int self,
+                               uint64_t min_size, job_t *stolen) {
+    int victim = -1;
+    uint64_t victim_size = 0;
+
+    for (int i = 0; i < board->count; i++) {
+        range_slot_t *slot = &board->slots[i];
+        uint64_t cursor = atomic_load_explicit(&slot->cursor,
+                                               memory_order_relaxed);
+        uint64_t end = atomic_load_explicit(&slot->end, memory_order_relaxed);
+
+        if (i != self && end > cursor && end - cursor > victim_size) {
+            victim = i;
+            victim_size = end - cursor;
+        }
+    }
+
+    if (victim == -1 || victim_size < min_size) {
+        return false;
+    }
+
+    range_slot_t *slot = &board->slots[victim];
+    range_slot_lock(slot);
+
+    // The owner kept claiming while the board was scanned
+    uint64_t cursor = atomic_load(&slot->cursor);
+    uint64_t end = atomic_load(&slot->end);
+
+    if (end <= cursor || end - cursor < min_size) {
+        range_slot_unlock(slot);
+        return false;
+    }
+
+    uint64_t middle = cursor + (end - cursor) / 2;
+    atomic_store(&slot->end, middle);
+
+    *stolen = slot->job;
+    stolen->start = middle;
+    stolen->end = end;
+
+    range_slot_unlock(slot);
+
+    return true;
+}
+
+/**
+ * @brief Create the shared memory segment holding the range board
+ *
+ * @return The mapped board, or NULL with errno set on failure
+ */
+static inline range_board_t *range_board_create(const char *name, int count) {
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+    if (fd == -1) {
+        return NULL;
+    }
+
+    size_t size = range_board_size(count);
+
+    if (ftruncate(fd, size) == -1) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    range_board_t *board = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (board == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    // The segment starts out zeroed, so every slot starts out unlocked and
+    // with an empty range
+    board->count = count;
+
+    return board;
+}
+
+/**
+ * @brief Map the range board created by the farmer
+ *
+ * @return The mapped board, or NULL with errno set on failure
+ */
+static inline range_board_t *range_board_open(const char *name) {
+    int fd = shm_open(name, O_RDWR, 0);
+
+    if (fd == -1) {
+        return NULL;
+    }
+
+    int count;
+    if (pread(fd, &count, sizeof(count), 0) != sizeof(count)) {
+        close(fd);
+        return NULL;
+    }
+
+    range_board_t *board = mmap(NULL, range_board_size(count),
+                                PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    return board == MAP_FAILED ? NULL : board;
+}
+
+static inline void range_board_close(range_board_t *board) {
+    munmap(board, range_board_size(board->count));
+}
+
+#endif // RANGES_H_
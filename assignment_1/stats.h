@@ -0,0 +1,185 @@
+/*
+ * Operating Systems (2INCO) Practical Assignment
+ * Interprocess Communication
+ *
+ * Zachary Kohnen (1655221)
+ *
+ * The stats board: live counters of every worker in a shared memory segment
+ * created by the farmer. Every worker only writes its own slot, which has a
+ * cache line to itself so that counting never contends with other workers.
+ * Other tools can map the segment while the farmer runs.
+ *
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// The counters of one worker, which only that worker writes
+typedef struct {
+    _Alignas(64) _Atomic uint64_t candidates; // The amount hashed
+    _Atomic uint64_t jobs; // The amount of jobs run, cancelled or not
+    _Atomic uint64_t cancelled; // The amount of jobs cancelled or skipped
+    _Atomic uint64_t idle_nanoseconds; // Time spent waiting for a job
+    _Atomic int busy; // Set while the worker runs a job
+    _Atomic int pid; // 0 until the worker started
+
+    // Where the farmer placed the worker, -1 if it was not pinned
+    int node;
+    int cpu; // The lowest CPU the worker may run on
+} worker_stats_t;
+
+// The stats board as it is laid out in the shared memory segment
+typedef struct {
+    int count;
+    char placement[16]; // The name of the placement policy
+    worker_stats_t workers[];
+} stats_board_t;
+
+// The totals over all workers at one moment
+typedef struct {
+    uint64_t candidates;
+    uint64_t jobs;
+    uint64_t cancelled;
+    uint64_t idle_nanoseconds;
+    int busy; // The amount of busy workers
+    int running; // The amount of workers that started and did not exit
+} stats_totals_t;
+
+static inline size_t stats_board_size(int count) {
+    return sizeof(stats_board_t) + sizeof(worker_stats_t) * (size_t)count;
+}
+
+static inline void stats_add(_Atomic uint64_t *counter, uint64_t amount) {
+    atomic_fetch_add_explicit(counter, amount, memory_order_relaxed);
+}
+
+static inline void stats_totals(const stats_board_t *board,
+                                stats_totals_t *totals) {
+    *totals = (stats_totals_t){ .candidates = 0 };
+
+    for (int i = 0; i < board->count; i++) {
+        worker_stats_t *stats = (worker_stats_t *)&board->workers[i];
+
+        totals->candidates += atomic_load_explicit(&stats->candidates,
+                                                   memory_order_relaxed);
+        totals->jobs += atomic_load_explicit(&stats->jobs,
+                                             memory_order_relaxed);
+        totals->cancelled += atomic_load_explicit(&stats->cancelled,
+                                                  memory_order_relaxed);
+        totals->idle_nanoseconds +=
+            atomic_load_explicit(&stats->idle_nanoseconds,
+                                 memory_order_relaxed);
+        totals->busy += atomic_load_explicit(&stats->busy,
+                                             memory_order_relaxed) != 0;
+        totals->running += atomic_load_explicit(&stats->pid,
+                                                memory_order_relaxed) != 0;
+    }
+}
+
+/**
+ * @brief Write the counters of every worker as tab separated values, one line
+ * per worker after a comment naming the placement policy and a line naming
+ * the columns
+ *
+ * @return false if the file could not be written
+ */
+static inline bool stats_board_write(const stats_board_t *board, FILE *file) {
+    fprintf(file, "# placement %s\n", board->placement);
+    fprintf(file, "worker\tpid\tnode\tcpu\tcandidates\tjobs\tcancelled\t"
+                  "idle_ms\tbusy\n");
+
+    for (int i = 0; i < board->count; i++) {
+        worker_stats_t *stats = (worker_stats_t *)&board->workers[i];
+
+        fprintf(file, "%d\t%d\t%d\t%d\t%lu\t%lu\t%lu\t%.1f\t%d\n", i,
+                atomic_load(&stats->pid), stats->node, stats->cpu,
+                atomic_load(&stats->candidates), atomic_load(&stats->jobs),
+                atomic_load(&stats->cancelled),
+                atomic_load(&stats->idle_nanoseconds) / 1e6,
+                atomic_load(&stats->busy));
+    }
+
+    return !ferror(file);
+}
+
+/**
+ * @brief Create the shared memory segment holding the stats board
+ *
+ * @param placement The name of the placement policy of the workers
+ * @return The mapped board, or NULL with errno set on failure
+ */
+static inline stats_board_t *stats_board_create(const char *name, int count,
+                                                const char *placement) {
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+    if (fd == -1) {
+        return NULL;
+    }
+
+    size_t size = stats_board_size(count);
+
+    if (ftruncate(fd, size) == -1) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    stats_board_t *board = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (board == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    // The segment starts out zeroed, so every counter starts out at 0
+    board->count = count;
+    snprintf(board->placement, sizeof(board->placement), "%s", placement);
+
+    for (int i = 0; i < count; i++) {
+        board->workers[i].node = -1;
+        board->workers[i].cpu = -1;
+    }
+
+    return board;
+}
+
+/**
+ * @brief Map the stats board created by the farmer
+ *
+ * @return The mapped board, or NULL with errno set on failure
+ */
+static inline stats_board_t *stats_board_open(const char *name) {
+    int fd = shm_open(name, O_RDWR, 0);
+
+    if (fd == -1) {
+        return NULL;
+    }
+
+    int count;
+    if (pread(fd, &count, sizeof(count), 0) != sizeof(count)) {
+        close(fd);
+        return NULL;
+    }
+
+    stats_board_t *board = mmap(NULL, stats_board_size(count),
+                                PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    return board == MAP_FAILED ? NULL : board;
+}
+
+static inline void stats_board_close(stats_board_t *board) {
+    munmap(board, stats_board_size(board->count));
+}
+
+#endif // STATS_H_
@@ -0,0 +1,302 @@
+/*
+ * Operating Systems (2INCO) Practical Assignment
+ * Interprocess Communication
+ *
+ * Zachary Kohnen (1655221)
+ *
+ * The list of target hashes shared by the farmer with the workers through
+ * shared memory, which also tells the workers which hashes are solved so they
+ * can cancel their jobs, and the lookup table the workers build from it to
+ * check every digest against all targets at once. When streaming, the farmer
+ * loads every window of hashes into the same list.
+ *
+ */
+
+#ifndef TARGETS_H_
+#define TARGETS_H_
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "md5_kernel.h"
+#include "uint128.h"
+
+// The target list as it is laid out in the shared memory segment, the index
+// of a hash in the list is its hash_id. The hashes are followed by one solved
+// flag per hash, which only the farmer writes.
+typedef struct {
+    int capacity; // The most hashes the list can hold
+    int count;
+    _Atomic uint32_t generation; // Bumped every time hashes are loaded
+    _Atomic int unsolved; // The amount of hashes without a match
+    uint128_t hashes[];
+} target_list_t;
+
+static inline size_t target_list_size(int capacity) {
+    return sizeof(target_list_t) + sizeof(uint128_t) * (size_t)capacity +
+           sizeof(_Atomic uint8_t) * (size_t)capacity;
+}
+
+static inline _Atomic uint8_t *target_list_solved(const target_list_t *list) {
+    return (_Atomic uint8_t *)&list->hashes[list->capacity];
+}
+
+/**
+ * @brief Mark a hash as solved, so that the workers stop searching for it
+ */
+static inline void target_list_solve(target_list_t *list, int hash_id) {
+    if (atomic_exchange(&target_list_solved(list)[hash_id], 1) == 0) {
+        atomic_fetch_sub(&list->unsolved, 1);
+    }
+}
+
+static inline bool target_list_is_solved(const target_list_t *list,
+                                         int hash_id) {
+    return atomic_load_explicit(&target_list_solved(list)[hash_id],
+                                memory_order_relaxed) != 0;
+}
+
+static inline bool target_list_all_solved(const target_list_t *list) {
+    return atomic_load_explicit(&list->unsolved,
+                                memory_order_relaxed) == 0;
+}
+
+/**
+ * @brief Replace the hashes in the list, marking all of them unsolved. Only
+ * safe while no worker runs a job.
+ */
+static inline void target_list_load(target_list_t *list,
+                                    const uint128_t *hashes, int count) {
+    list->count = count;
+    memcpy(list->hashes, hashes, sizeof(uint128_t) * (size_t)count);
+
+    for (int hash_id = 0; hash_id < count; hash_id++) {
+        atomic_store_explicit(&target_list_solved(list)[hash_id], 0,
+                              memory_order_relaxed);
+    }
+
+    atomic_store(&list->unsolved, count);
+    atomic_fetch_add_explicit(&list->generation, 1, memory_order_release);
+}
+
+static inline uint32_t target_list_generation(const target_list_t *list) {
+    return atomic_load_explicit(&((target_list_t *)list)->generation,
+                                memory_order_acquire);
+}
+
+/**
+ * @brief Create the shared memory segment holding the target list, loaded
+ * with the given hashes
+ *
+ * @param capacity The most hashes the list will ever hold, at least count
+ * @return The mapped list, or NULL with errno set on failure
+ */
+static inline target_list_t *target_list_create(const char *name,
+                                                int capacity,
+                                                const uint128_t *hashes,
+                                                int count) {
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+    if (fd == -1) {
+        return NULL;
+    }
+
+    size_t size = target_list_size(capacity);
+
+    if (ftruncate(fd, size) == -1) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    target_list_t *list = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (list == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    list->capacity = capacity;
+    target_list_load(list, hashes, count);
+
+    return list;
+}
+
+/**
+ * @brief Map the target list created by the farmer
+ *
+ * @return The mapped list, or NULL with errno set on failure
+ */
+static inline target_list_t *target_list_open(const char *name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+
+    if (fd == -1) {
+        return NULL;
+    }
+
+    int capacity;
+    if (pread(fd, &capacity, sizeof(capacity), 0) != sizeof(capacity)) {
+        close(fd);
+        return NULL;
+    }
+
+    target_list_t *list = mmap(NULL, target_list_size(capacity), PROT_READ,
+                               MAP_SHARED, fd, 0);
+    close(fd);
+
+    return list == MAP_FAILED ? NULL : list;
+}
+
+static inline void target_list_close(target_list_t *list) {
+    munmap(list, target_list_size(list->capacity));
+}
+
+// A slot of the open addressed table, keyed on the first MD5 state word
+typedef struct {
+    uint32_t key;
+    int hash_id; // -1 if the slot is empty
+} target_slot_t;
+
+/**
+ * @brief Lookup table over all targets. A bitmap indexed by the top bits of
+ * the first state word rules out nearly every digest before the table itself
+ * is touched, which keeps lookups cheap even when the table is far larger
+ * than the cache.
+ */
+typedef struct {
+    md5_target_t *targets; // Indexed by hash_id
+    int count;
+
+    uint64_t *filter;
+    int filter_shift; // 32 - log2(amount of bits in the filter)
+
+    target_slot_t *slots;
+    uint32_t slot_mask; // Amount of slots - 1, the amount is a power of 2
+} target_table_t;
+
+// A match of one lane against one of the targets
+typedef struct {
+    int lane;
+    int hash_id;
+} target_match_t;
+
+/**
+ * @brief Build the lookup table from the target list. The md5 kernel must be
+ * selected first, since it decides how hashes map onto state words.
+ *
+ * @return false if memory could not be allocated
+ */
+static inline bool target_table_build(target_table_t *table,
+                                      const target_list_t *list) {
+    int count = list->count;
+
+    // Keep the table at most half full and use 16 filter bits per target
+    uint32_t slots = 16;
+    while (slots < (uint32_t)count * 2) {
+        slots *= 2;
+    }
+
+    int filter_bits_log2 = 12;
+    while (filter_bits_log2 < 32 && (1ull << filter_bits_log2) < slots * 8ull) {
+        filter_bits_log2++;
+    }
+
+    table->count = count;
+    table->slot_mask = slots - 1;
+    table->filter_shift = 32 - filter_bits_log2;
+    table->targets = malloc(sizeof(md5_target_t) * (size_t)(count + 1));
+    table->slots = malloc(sizeof(target_slot_t) * slots);
+    table->filter = calloc((1ull << filter_bits_log2) / 64, sizeof(uint64_t));
+
+    if (table->targets == NULL || table->slots == NULL ||
+        table->filter == NULL) {
+        free(table->targets);
+        free(table->slots);
+        free(table->filter);
+        return false;
+    }
+
+    for (uint32_t slot = 0; slot < slots; slot++) {
+        table->slots[slot].hash_id = -1;
+    }
+
+    for (int hash_id = 0; hash_id < count; hash_id++) {
+        md5_target_t target = md5_target(list->hashes[hash_id]);
+        table->targets[hash_id] = target;
+
+        uint32_t key = target.state[0];
+        uint32_t bit = key >> table->filter_shift;
+        table->filter[bit / 64] |= 1ull << (bit % 64);
+
+        uint32_t slot = key & table->slot_mask;
+        while (table->slots[slot].hash_id != -1) {
+            slot = (slot + 1) & table->slot_mask;
+        }
+
+        table->slots[slot] = (target_slot_t){ .key = key, .hash_id = hash_id };
+    }
+
+    return true;
+}
+
+static inline void target_table_free(target_table_t *table) {
+    free(table->targets);
+    free(table->slots);
+    free(table->filter);
+}
+
+/**
+ * @brief Check every lane of the digests against all targets in the table
+ *
+ * @param matches Receives the matches, must have room for max_matches entries
+ * @return The amount of matches written to matches
+ */
+static inline int target_table_match(const target_table_t *table,
+                                     const md5_digests_t *digests, int count,
+                                     target_match_t *matches, int max_matches) {
+    int found = 0;
+
+    for (int lane = 0; lane < count; lane++) {
+        uint32_t key = digests->state[0][lane];
+        uint32_t bit = key >> table->filter_shift;
+
+        if ((table->filter[bit / 64] & (1ull << (bit % 64))) == 0) {
+            continue;
+        }
+
+        // Equal hashes may be in the list more than once, so keep probing
+        // until an empty slot
+        for (uint32_t slot = key & table->slot_mask;
+             table->slots[slot].hash_id != -1;
+             slot = (slot + 1) & table->slot_mask) {
+            if (table->slots[slot].key != key) {
+                continue;
+            }
+
+            int hash_id = table->slots[slot].hash_id;
+            const md5_target_t *target = &table->targets[hash_id];
+
+            if (digests->state[1][lane] == target->state[1] &&
+                digests->state[2][lane] == target->state[2] &&
+                digests->state[3][lane] == target->state[3] &&
+                found < max_matches) {
+                matches[found++] = (target_match_t){
+                    .lane = lane,
+                    .hash_id = hash_id,
+                };
+            }
+        }
+    }
+
+    return found;
+}
+
+#endif // TARGETS_H_
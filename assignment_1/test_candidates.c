@@ -0,0 +1,348 @@
+/*
+ * Operating Systems (2INCO) Practical Assignment
+ * Interprocess Communication
+ *
+ * Zachary Kohnen (1655221)
+ *
+ * Tests of the candidate generator. Enumerates a few small keyspaces and
+ * checks the amount and the order of the candidates, their padding, that
+ * seeking gives the same candidates as stepping, and that the specialised
+ * generators give the same batches as the generic one.
+ *
+ * usage: test_candidates
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "candidates.h"
+
+// The longest message of the keyspaces that are tested
+#define TEST_LENGTH_LIMIT 16
+
+// The amount of candidates emitted after a seek, more than two batches so
+// that a run crosses batches
+#define SEEK_RUN 37
+
+// The keyspace of a job: a prefix followed by chars of the alphabet
+typedef struct {
+    const char *prefix;
+    char alphabet_start;
+    char alphabet_stop;
+    int max_length;
+} test_keyspace_t;
+
+typedef struct {
+    char text[TEST_LENGTH_LIMIT];
+    int length;
+} test_message_t;
+
+static int failures = 0;
+
+#define CHECK(condition, ...)                          \
+    do {                                               \
+        if (!(condition)) {                            \
+            fprintf(stderr, "test_candidates: ");      \
+            fprintf(stderr, __VA_ARGS__);              \
+            fprintf(stderr, "\n");                     \
+            failures++;                                \
+        }                                              \
+    } while (0)
+
+static void keyspace_init(const test_keyspace_t *keyspace,
+                          candidates_t *candidates) {
+    candidates_init(candidates, keyspace->prefix, strlen(keyspace->prefix),
+                    keyspace->alphabet_start, keyspace->alphabet_stop,
+                    keyspace->max_length);
+}
+
+static uint64_t keyspace_count(const test_keyspace_t *keyspace, int length) {
+    return candidates_count(strlen(keyspace->prefix),
+                            keyspace->alphabet_stop -
+                                keyspace->alphabet_start + 1,
+                            length);
+}
+
+/**
+ * @brief Shorter messages come first, then lexicographic order
+ */
+static bool message_before(const test_message_t *a, const test_message_t *b) {
+    if (a->length != b->length) {
+        return a->length < b->length;
+    }
+
+    return memcmp(a->text, b->text, a->length) < 0;
+}
+
+static bool message_equal(const test_message_t *a, const test_message_t *b) {
+    return a->length == b->length && memcmp(a->text, b->text, a->length) == 0;
+}
+
+/**
+ * @brief Check the padding of the block of a lane and that its message is
+ * made of the prefix and chars of the alphabet
+ */
+static void check_block(const test_keyspace_t *keyspace, const uint8_t *block,
+                        int length) {
+    size_t prefix_length = strlen(keyspace->prefix);
+
+    CHECK(memcmp(block, keyspace->prefix, prefix_length) == 0,
+          "a message of length %d does not start with the prefix", length);
+
+    for (int i = prefix_length; i < length; i++) {
+        CHECK(block[i] >= (uint8_t)keyspace->alphabet_start &&
+                  block[i] <= (uint8_t)keyspace->alphabet_stop,
+              "char %d of a message of length %d is not in the alphabet", i,
+              length);
+    }
+
+    CHECK(block[length] == 0x80, "no end marker after length %d", length);
+
+    for (int i = length + 1; i < 56; i++) {
+        CHECK(block[i] == 0, "byte %d is not zero after length %d", i, length);
+    }
+
+    uint64_t bit_length;
+    memcpy(&bit_length, &block[56], sizeof(bit_length));
+
+    CHECK(bit_length == (uint64_t)length * 8,
+          "bit length %lu for a message of length %d", bit_length, length);
+}
+
+/**
+ * @brief Emit every candidate left, checking every batch against the one the
+ * generic generator fills from the same state
+ *
+ * @return The amount of candidates emitted, of which up to capacity are
+ * stored in messages
+ */
+static size_t collect(const test_keyspace_t *keyspace,
+                      candidates_t *candidates, test_message_t *messages,
+                      size_t capacity) {
+    candidates_t generic = *candidates;
+    md5_batch_t batch = { 0 };
+    md5_batch_t generic_batch = { 0 };
+    size_t count = 0;
+
+    while (candidates_next_batch(candidates, &batch)) {
+        CHECK(!generic.done, "the generic generator finished first");
+        candidates_fill_generic(&generic, &generic_batch);
+
+        CHECK(batch.count > 0, "an empty batch was emitted");
+        CHECK(batch.count == generic_batch.count &&
+                  batch.length == generic_batch.length,
+              "a batch of %d candidates of length %d, the generic one has "
+              "%d of length %d",
+              batch.count, batch.length, generic_batch.count,
+              generic_batch.length);
+
+        if (batch.count <= 0 || batch.count != generic_batch.count) {
+            return count;
+        }
+
+        for (int lane = 0; lane < batch.count; lane++) {
+            uint8_t block[64];
+
+            for (int w = 0; w < 16; w++) {
+                CHECK(batch.words[w][lane] == generic_batch.words[w][lane],
+                      "word %d of lane %d differs from the generic generator",
+                      w, lane);
+                memcpy(&block[w * 4], &batch.words[w][lane], sizeof(uint32_t));
+            }
+
+            check_block(keyspace, block, batch.length);
+
+            if (count < capacity) {
+                memcpy(messages[count].text, block, batch.length);
+                messages[count].length = batch.length;
+            }
+
+            count++;
+        }
+    }
+
+    CHECK(generic.done, "the generic generator has candidates left");
+
+    return count;
+}
+
+/**
+ * @brief Enumerate the whole keyspace, then seek to every candidate of it
+ */
+static void test_keyspace(const test_keyspace_t *keyspace) {
+    uint64_t expected = keyspace_count(keyspace, keyspace->max_length);
+    test_message_t *stepped = malloc(sizeof(test_message_t) * (expected + 1));
+
+    if (stepped == NULL) {
+        perror("Failed to allocate the candidates");
+        exit(1);
+    }
+
+    candidates_t candidates;
+    keyspace_init(keyspace, &candidates);
+    size_t count = collect(keyspace, &candidates, stepped, expected + 1);
+
+    CHECK(count == expected, "%s%c-%c up to %d: %zu candidates instead of %lu",
+          keyspace->prefix, keyspace->alphabet_start, keyspace->alphabet_stop,
+          keyspace->max_length, count, expected);
+
+    if (count > expected) {
+        count = expected;
+    }
+
+    for (size_t i = 1; i < count; i++) {
+        CHECK(message_before(&stepped[i - 1], &stepped[i]),
+              "candidate %zu is not after candidate %zu", i, i - 1);
+    }
+
+    // Seeking to every candidate, and just past the last one
+    for (uint64_t i = 0; i <= count; i++) {
+        test_message_t run[SEEK_RUN];
+
+        keyspace_init(keyspace, &candidates);
+        candidates_seek(&candidates, i, SEEK_RUN);
+        size_t run_count = collect(keyspace, &candidates, run, SEEK_RUN);
+        size_t run_expected = count - i < SEEK_RUN ? count - i : SEEK_RUN;
+
+        CHECK(run_count == run_expected,
+              "%zu candidates after seeking to %lu instead of %zu", run_count,
+              i, run_expected);
+
+        for (size_t j = 0; j < run_count && j < run_expected; j++) {
+            CHECK(message_equal(&run[j], &stepped[i + j]),
+                  "seeking to %lu gives another candidate %zu", i, j);
+        }
+    }
+
+    free(stepped);
+}
+
+/**
+ * @brief Seek around the first candidate of every length of a keyspace that
+ * is too big to enumerate, checking the run against seeking to every
+ * candidate in it
+ */
+static void test_lengths(const test_keyspace_t *keyspace) {
+    int first_length = strlen(keyspace->prefix) + 1;
+
+    for (int length = first_length; length < keyspace->max_length; length++) {
+        uint64_t boundary = keyspace_count(keyspace, length);
+
+        // The small keyspaces already cover the first lengths
+        if (boundary < SEEK_RUN / 2) {
+            continue;
+        }
+
+        uint64_t start = boundary - SEEK_RUN / 2;
+        test_message_t run[SEEK_RUN];
+        candidates_t candidates;
+
+        keyspace_init(keyspace, &candidates);
+        candidates_seek(&candidates, start, SEEK_RUN);
+        size_t run_count = collect(keyspace, &candidates, run, SEEK_RUN);
+
+        CHECK(run_count == SEEK_RUN, "%zu candidates around length %d",
+              run_count, length);
+
+        for (size_t j = 0; j < run_count; j++) {
+            test_message_t single;
+
+            keyspace_init(keyspace, &candidates);
+            candidates_seek(&candidates, start + j, 1);
+
+            CHECK(collect(keyspace, &candidates, &single, 1) == 1 &&
+                      message_equal(&run[j], &single),
+                  "seeking to %lu gives another candidate", start + j);
+
+            if (j > 0) {
+                CHECK(message_before(&run[j - 1], &run[j]),
+                      "candidate %lu is not after the one before it",
+                      start + j);
+            }
+        }
+
+        // The last candidate of a length is all the last char of the
+        // alphabet, the first of the next length all the first char
+        const test_message_t *last = &run[SEEK_RUN / 2 - 1];
+        const test_message_t *first = &run[SEEK_RUN / 2];
+
+        CHECK(last->length == length && first->length == length + 1 &&
+                  last->text[length - 1] == keyspace->alphabet_stop &&
+                  first->text[length] == keyspace->alphabet_start,
+              "the candidates around length %d are not the last and first",
+              length);
+    }
+}
+
+/**
+ * @brief Check which alphabets and lengths get a specialised generator
+ */
+static void test_select(char alphabet_start, char alphabet_stop,
+                        bool specialised) {
+    for (int length = 1; length <= CANDIDATES_SPECIALISED_LENGTHS + 1;
+         length++) {
+        candidates_t candidates;
+        candidates_init(&candidates, "", 0, alphabet_start, alphabet_stop,
+                        length);
+        candidates_seek(&candidates,
+                        candidates_count(0, alphabet_stop - alphabet_start + 1,
+                                         length - 1),
+                        1);
+
+        bool picked = candidates_select(&candidates) != candidates_fill_generic;
+
+        CHECK(picked == (specialised &&
+                         length <= CANDIDATES_SPECIALISED_LENGTHS),
+              "%c-%c of length %d %s a specialised generator", alphabet_start,
+              alphabet_stop, length, picked ? "has" : "does not have");
+    }
+}
+
+int main(void) {
+    const test_keyspace_t keyspaces[] = {
+        { "", 'a', 'c', 4 },
+        { "", 'a', 'a', 5 },
+        { "", 'a', 'p', 3 },
+        { "", 'a', 'z', 3 },
+        { "", 'A', 'Z', 2 },
+        { "", '0', '9', 4 },
+        { "ab", 'a', 'd', 5 },
+        { "q", '0', '9', 3 },
+        { "abc", 'a', 'z', 3 },
+    };
+
+    for (size_t i = 0; i < sizeof(keyspaces) / sizeof(keyspaces[0]); i++) {
+        test_keyspace(&keyspaces[i]);
+    }
+
+    // Every length of the specialised generators, and the generic one after
+    const test_keyspace_t long_keyspaces[] = {
+        { "", 'a', 'z', CANDIDATES_SPECIALISED_LENGTHS + 1 },
+        { "", 'A', 'Z', CANDIDATES_SPECIALISED_LENGTHS + 1 },
+        { "", '0', '9', CANDIDATES_SPECIALISED_LENGTHS + 1 },
+        { "x", 'a', 'z', CANDIDATES_SPECIALISED_LENGTHS + 1 },
+    };
+
+    for (size_t i = 0; i < sizeof(long_keyspaces) / sizeof(long_keyspaces[0]);
+         i++) {
+        test_lengths(&long_keyspaces[i]);
+    }
+
+    test_select('a', 'z', true);
+    test_select('A', 'Z', true);
+    test_select('0', '9', true);
+    test_select('a', 'p', false);
+
+    if (failures > 0) {
+        fprintf(stderr, "test_candidates: %d checks failed\n", failures);
+        return 1;
+    }
+
+    printf("test_candidates: all checks passed\n");
+
+    return 0;
+}
@@ -0,0 +1,428 @@
+/*
+ * Operating Systems (2INCO) Practical Assignment
+ * Interprocess Communication
+ *
+ * Zachary Kohnen (1655221)
+ *
+ * Discovery of the NUMA nodes of the machine and the CPUs and physical cores
+ * in them, read from sysfs so that no NUMA library is needed, and the
+ * placement of the farmer and the workers on them
+ *
+ */
+
+#ifndef TOPOLOGY_H_
+#define TOPOLOGY_H_
+
+#include <linux/mempolicy.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// The most NUMA nodes that are told apart
+#define TOPOLOGY_MAX_NODES 64
+
+// The most CPUs that can be placed on, higher CPUs are left alone
+#define TOPOLOGY_MAX_CPUS 1024
+
+// One past the highest node number memory can be preferred from, at most
+// TOPOLOGY_MAX_CPUS so that node lists fit in a topology_cpus_t
+#define TOPOLOGY_MAX_NODE_ID 1024
+
+// A set of CPUs, in the layout sched_setaffinity() takes
+typedef struct {
+    uint64_t bits[TOPOLOGY_MAX_CPUS / 64];
+} topology_cpus_t;
+
+typedef struct {
+    int id; // The number of the node in sysfs
+    int cpu_count; // The amount of online CPUs in the node
+    topology_cpus_t cpus;
+} topology_node_t;
+
+// A physical core, with all of its SMT siblings
+typedef struct {
+    int cpu; // The lowest CPU of the core
+    int node; // The index of the node of the core in the nodes
+    topology_cpus_t cpus;
+} topology_core_t;
+
+typedef struct {
+    int node_count;
+    topology_node_t nodes[TOPOLOGY_MAX_NODES];
+    int core_count;
+    topology_core_t cores[TOPOLOGY_MAX_CPUS];
+} topology_t;
+
+static inline void topology_cpus_add(topology_cpus_t *cpus, long cpu) {
+    if (cpu >= 0 && cpu < TOPOLOGY_MAX_CPUS) {
+        cpus->bits[cpu / 64] |= 1ull << (cpu % 64);
+    }
+}
+
+static inline bool topology_cpus_has(const topology_cpus_t *cpus, int cpu) {
+    return (cpus->bits[cpu / 64] >> (cpu % 64)) & 1;
+}
+
+/**
+ * @brief Count the CPUs in a sysfs CPU list, such as "0-3,8-11", adding them
+ * to cpus if it is not NULL
+ */
+static inline int topology_parse_cpus(const char *list, topology_cpus_t *cpus) {
+    int count = 0;
+
+    while (*list != '\0' && *list != '\n') {
+        char *end;
+        long first = strtol(list, &end, 10);
+        long last = first;
+
+        if (end == list) {
+            break;
+        }
+
+        if (*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+        }
+
+        for (long cpu = first; cpus != NULL && cpu <= last; cpu++) {
+            topology_cpus_add(cpus, cpu);
+        }
+
+        count += (int)(last - first + 1);
+        list = *end == ',' ? end + 1 : end;
+    }
+
+    return count;
+}
+
+/**
+ * @brief Read a CPU list from sysfs
+ *
+ * @return The amount of CPUs in the list, or -1 if it could not be read
+ */
+static inline int topology_read_cpus(const char *path, topology_cpus_t *cpus) {
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL) {
+        return -1;
+    }
+
+    char list[4096];
+    int count = 0;
+
+    if (fgets(list, sizeof(list), file) != NULL) {
+        count = topology_parse_cpus(list, cpus);
+    }
+
+    fclose(file);
+
+    return count;
+}
+
+/**
+ * @brief Find the physical cores among the online CPUs. A CPU starts a core
+ * when it is the lowest of its SMT siblings, CPUs without topology in sysfs
+ * are cores of their own.
+ */
+static inline void topology_detect_cores(topology_t *topology) {
+    topology_cpus_t online = { { 0 } };
+
+    if (topology_read_cpus("/sys/devices/system/cpu/online", &online) <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        for (long cpu = 0; cpu < (cpus > 0 ? cpus : 1); cpu++) {
+            topology_cpus_add(&online, cpu);
+        }
+    }
+
+    topology->core_count = 0;
+
+    for (int cpu = 0; cpu < TOPOLOGY_MAX_CPUS; cpu++) {
+        if (!topology_cpus_has(&online, cpu)) {
+            continue;
+        }
+
+        char path[128];
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list",
+                 cpu);
+
+        topology_cpus_t siblings = { { 0 } };
+
+        if (topology_read_cpus(path, &siblings) <= 0) {
+            topology_cpus_add(&siblings, cpu);
+        }
+
+        // Only the lowest sibling starts the core
+        bool first = true;
+        for (int sibling = 0; sibling < cpu; sibling++) {
+            if (topology_cpus_has(&siblings, sibling)) {
+                first = false;
+                break;
+            }
+        }
+
+        if (!first) {
+            continue;
+        }
+
+        int node = 0;
+        for (int i = 0; i < topology->node_count; i++) {
+            if (topology_cpus_has(&topology->nodes[i].cpus, cpu)) {
+                node = i;
+                break;
+            }
+        }
+
+        topology->cores[topology->core_count++] = (topology_core_t){
+            .cpu = cpu,
+            .node = node,
+            .cpus = siblings,
+        };
+    }
+}
+
+/**
+ * @brief Find the NUMA nodes that have CPUs, and the physical cores in them.
+ * Machines without NUMA support in sysfs are reported as a single node holding
+ * every online CPU.
+ */
+static inline void topology_detect(topology_t *topology) {
+    topology->node_count = 0;
+
+    // Node numbers can have gaps, so only the nodes sysfs lists are read.
+    // The lists have the format of CPU lists.
+    topology_cpus_t ids = { { 0 } };
+
+    if (topology_read_cpus("/sys/devices/system/node/has_cpu", &ids) <= 0) {
+        topology_read_cpus("/sys/devices/system/node/online", &ids);
+    }
+
+    for (int id = 0; id < TOPOLOGY_MAX_NODE_ID &&
+                     topology->node_count < TOPOLOGY_MAX_NODES;
+         id++) {
+        if (!topology_cpus_has(&ids, id)) {
+            continue;
+        }
+
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+                 id);
+
+        topology_cpus_t cpus = { { 0 } };
+        int cpu_count = topology_read_cpus(path, &cpus);
+
+        // Memory-only nodes cannot run a worker
+        if (cpu_count > 0) {
+            topology->nodes[topology->node_count++] = (topology_node_t){
+                .id = id,
+                .cpu_count = cpu_count,
+                .cpus = cpus,
+            };
+        }
+    }
+
+    if (topology->node_count == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        topology->nodes[0] = (topology_node_t){
+            .id = 0,
+            .cpu_count = cpus > 0 ? (int)cpus : 1,
+        };
+
+        for (long cpu = 0; cpu < topology->nodes[0].cpu_count; cpu++) {
+            topology_cpus_add(&topology->nodes[0].cpus, cpu);
+        }
+
+        topology->node_count = 1;
+    }
+
+    topology_detect_cores(topology);
+}
+
+typedef enum {
+    PLACEMENT_NONE, // Leave placing the processes to the scheduler
+    PLACEMENT_CORE, // Every worker gets a physical core, the farmer as well
+    PLACEMENT_NODE, // Every worker gets all CPUs of a node
+} placement_policy_t;
+
+static const char *const placement_policy_names[] = { "none", "core",
+                                                      "node" };
+
+/**
+ * @return false if there is no policy with the name
+ */
+static inline bool placement_policy_parse(const char *name,
+                                          placement_policy_t *policy) {
+    for (int i = PLACEMENT_NONE; i <= PLACEMENT_NODE; i++) {
+        if (strcmp(name, placement_policy_names[i]) == 0) {
+            *policy = (placement_policy_t)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Where a process is placed
+typedef struct {
+    bool pinned; // Cleared if the scheduler places the process
+    int node; // The number of the node in sysfs, -1 if not pinned
+    int cpu; // The lowest CPU the process may run on, -1 if not pinned
+    topology_cpus_t cpus;
+} placement_t;
+
+/**
+ * @brief The core with the given position in the order cores are handed out
+ * in: the first core of every node, then the second core of every node and
+ * so on, so that consecutive workers are spread over the nodes
+ */
+static inline const topology_core_t *topology_spread_core(
+    const topology_t *topology, int position) {
+    for (int round = 0;; round++) {
+        for (int node = 0; node < topology->node_count; node++) {
+            int seen = 0;
+
+            for (int core = 0; core < topology->core_count; core++) {
+                if (topology->cores[core].node != node) {
+                    continue;
+                }
+
+                if (seen++ == round && position-- == 0) {
+                    return &topology->cores[core];
+                }
+            }
+        }
+    }
+}
+
+static inline int topology_highest_cpu(const topology_cpus_t *cpus) {
+    for (int cpu = TOPOLOGY_MAX_CPUS - 1; cpu > 0; cpu--) {
+        if (topology_cpus_has(cpus, cpu)) {
+            return cpu;
+        }
+    }
+
+    return 0;
+}
+
+static inline void placement_on(placement_t *placement,
+                                 const topology_cpus_t *cpus, int node_id) {
+    placement->pinned = true;
+    placement->node = node_id;
+    placement->cpus = *cpus;
+    placement->cpu = 0;
+
+    while (placement->cpu < TOPOLOGY_MAX_CPUS - 1 &&
+           !topology_cpus_has(cpus, placement->cpu)) {
+        placement->cpu++;
+    }
+}
+
+/**
+ * @brief Where the farmer runs. With the core policy the farmer gets the last
+ * core handed out to itself, or when every core is needed by a worker, the
+ * last SMT sibling of that core.
+ */
+static inline void placement_of_farmer(const topology_t *topology,
+                                       placement_policy_t policy,
+                                       int worker_count,
+                                       placement_t *placement) {
+    *placement = (placement_t){ .pinned = false, .node = -1, .cpu = -1 };
+
+    if (policy != PLACEMENT_CORE) {
+        return;
+    }
+
+    const topology_core_t *core = topology_spread_core(
+        topology, topology->core_count - 1);
+    int node_id = topology->nodes[core->node].id;
+
+    if (topology->core_count > worker_count) {
+        placement_on(placement, &core->cpus, node_id);
+        return;
+    }
+
+    topology_cpus_t sibling = { { 0 } };
+    topology_cpus_add(&sibling, topology_highest_cpu(&core->cpus));
+    placement_on(placement, &sibling, node_id);
+}
+
+/**
+ * @brief Where a worker runs. Workers are spread over the nodes, and when
+ * there are more workers than cores or nodes they share them.
+ */
+static inline void placement_of_worker(const topology_t *topology,
+                                       placement_policy_t policy,
+                                       int worker_count, int worker,
+                                       placement_t *placement) {
+    *placement = (placement_t){ .pinned = false, .node = -1, .cpu = -1 };
+
+    if (policy == PLACEMENT_NODE) {
+        const topology_node_t *node =
+            &topology->nodes[worker % topology->node_count];
+
+        placement_on(placement, &node->cpus, node->id);
+        return;
+    }
+
+    if (policy != PLACEMENT_CORE) {
+        return;
+    }
+
+    // Keep the core of the farmer free when there are enough of them
+    bool shared = topology->core_count <= worker_count;
+    int usable = shared || topology->core_count == 1
+                     ? topology->core_count
+                     : topology->core_count - 1;
+
+    const topology_core_t *core = topology_spread_core(topology,
+                                                       worker % usable);
+    topology_cpus_t cpus = core->cpus;
+
+    // Leave the farmer its SMT sibling if the core has more than one CPU
+    const topology_core_t *farmer_core = topology_spread_core(
+        topology, topology->core_count - 1);
+    int farmer_cpu = topology_highest_cpu(&core->cpus);
+
+    if (shared && core == farmer_core && farmer_cpu != core->cpu) {
+        cpus.bits[farmer_cpu / 64] &= ~(1ull << (farmer_cpu % 64));
+    }
+
+    placement_on(placement, &cpus, topology->nodes[core->node].id);
+}
+
+/**
+ * @brief Pin the calling process to the CPUs of the placement, and make it
+ * take its memory from the node of the placement where possible. Both are
+ * kept across execve(), so a forked worker is placed before it execs.
+ *
+ * @return 0 on success, -1 with errno set if the process could not be pinned
+ */
+static inline int placement_apply(const placement_t *placement) {
+    if (!placement->pinned) {
+        return 0;
+    }
+
+    if (syscall(SYS_sched_setaffinity, 0, sizeof(placement->cpus),
+                &placement->cpus) == -1) {
+        return -1;
+    }
+
+    // Memory is only preferred, not bound, so a full node spills over. This
+    // fails without NUMA support in the kernel, where it does not matter.
+    unsigned long nodes[TOPOLOGY_MAX_NODE_ID / 64] = { 0 };
+
+    if (placement->node >= 0 && placement->node < TOPOLOGY_MAX_NODE_ID) {
+        nodes[placement->node / 64] |= 1ul << (placement->node % 64);
+        syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodes,
+                sizeof(nodes) * 8);
+    }
+
+    return 0;
+}
+#endif // TOPOLOGY_H_
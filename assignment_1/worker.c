@@ -14,7 +14,8 @@
 
 #include <complex.h>
 #include <errno.h>  // for perror()
-#include <mqueue.h> // for mq-stuff
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -22,129 +23,752 @@
 #include <time.h>   // for time()
 #include <unistd.h> // for getpid()
 
+#include "candidates.h"
 #include "common.h"
+#include "md5_kernel.h"
 #include "md5s.h"
+#include "queue.h"
+#include "ranges.h"
+#include "stats.h"
+#include "targets.h"
+
+// The most matches a single batch can report in multi-target mode
+#define MAX_BATCH_MATCHES (MD5_BATCH_LANES * 4)
+
+// The amount of batches hashed in between checks if the job was cancelled
+#define CANCEL_CHECK_BATCHES 64
+
+// The amount of candidates claimed from the range of a job at a time
+#define CLAIM_SIZE ((uint64_t)CANCEL_CHECK_BATCHES * MD5_BATCH_LANES)
+
+// Only split ranges with enough candidates left to be worth the stealing
+#define STEAL_MIN_SIZE (CLAIM_SIZE * 4)
+
+// The amount of responses the response queue should hold before it is full
+#define RESPONSES_IN_FLIGHT 128
 
 static void rsleep(int t);
 
+typedef enum {
+    SEARCH_CONTINUE, // Nothing stopped the search
+    SEARCH_FINISHED, // The job needs no more searching
+    SEARCH_FAILED, // A response could not be sent
+} search_status_t;
+
+typedef struct {
+    md5_kernel_t kernel;
+    queue_t job_queue;
+    queue_t response_queue;
+
+    // The target list tells which hashes are solved, and the lookup table
+    // built from it is used by every multi-target job. The table is rebuilt
+    // whenever the farmer loads new hashes into the list.
+    target_list_t *target_list;
+    target_table_t target_table;
+    bool target_table_built;
+    uint32_t target_table_generation;
+
+    range_board_t *range_board; // NULL if the workers do not share work
+    range_slot_t *range_slot; // Where the range of the current job is kept
+    int range_slot_index;
+
+    stats_board_t *stats_board; // NULL if the farmer does not collect stats
+    worker_stats_t *stats; // The counters of this worker
+
+    // The hashing threads all claim from the range of the current job, which
+    // the main thread hands them between two waits on the barrier
+    pthread_barrier_t job_barrier;
+    job_t job;
+    _Atomic uint64_t hashed; // The amount of candidates hashed for the job
+    _Atomic bool stopped; // Set once the job was finished or cancelled
+    _Atomic bool failed; // Set if a response could not be sent
+    _Atomic uint64_t retired_end; // The end of the range when it was stopped
+
+    // The jobs of the last message from the farmer that were not run yet
+    job_batch_t jobs;
+    int next_job;
+
+    // Responses are collected into a batch shared by the hashing threads,
+    // which is sent once it is full and at the end of every job
+    pthread_mutex_t responses_lock;
+    response_batch_t responses;
+    int response_batch_size;
+    bool responses_required; // Set if the farmer waits for a response
+} worker_t;
+
+/**
+ * @brief Send the collected responses to the farmer. Batches of only speed
+ * reports the farmer does not wait for are dropped instead of waiting for
+ * room, since the farmer only uses them to size its jobs. The responses lock
+ * must be held.
+ *
+ * @return false if the responses could not be sent
+ */
+static bool flush_responses_locked(worker_t *worker) {
+    if (worker->responses.count == 0) {
+        return true;
+    }
+
+    int send_status;
+    if (worker->responses_required) {
+        send_status = queue_send(&worker->response_queue, &worker->responses);
+    } else {
+        send_status = queue_try_send(&worker->response_queue,
+                                     &worker->responses);
+
+        if (send_status == -1 && errno == EAGAIN) {
+            send_status = 0;
+        }
+    }
+
+    worker->responses.count = 0;
+    worker->responses_required = false;
+
+    if (send_status == -1) {
+        fprintf(stderr, "%d: Failed to send message: %s\n",
+                getpid(), strerror(errno));
+
+        return false;
+    }
+
+    return true;
+}
+
+static bool flush_responses(worker_t *worker) {
+    pthread_mutex_lock(&worker->responses_lock);
+    bool sent = flush_responses_locked(worker);
+    pthread_mutex_unlock(&worker->responses_lock);
+
+    return sent;
+}
+
+/**
+ * @brief Add a response to the batch, sending the batch once it is full
+ *
+ * @param required Set if the response may not be dropped
+ * @return false if the batch could not be sent
+ */
+static bool add_response(worker_t *worker, const response_t *response,
+                         bool required) {
+    pthread_mutex_lock(&worker->responses_lock);
+
+    worker->responses.responses[worker->responses.count++] = *response;
+    worker->responses_required |= required;
+
+    bool sent = true;
+    if (worker->responses.count == worker->response_batch_size) {
+        sent = flush_responses_locked(worker);
+    }
+
+    pthread_mutex_unlock(&worker->responses_lock);
+
+    return sent;
+}
+
+/**
+ * @brief Send a match for the hash with the given ID back to the farmer
+ *
+ * @param match The matching message, in a buffer of MESSAGE_LENGTH_LIMIT + 1
+ * chars
+ * @return false if the response could not be sent
+ */
+static bool send_response(worker_t *worker, const char *match, int hash_id) {
+    response_t response = { .hash_id = hash_id };
+    memcpy(response.match, match, MESSAGE_LENGTH_LIMIT + 1);
+
+    return add_response(worker, &response, true);
+}
+
+/**
+ * @brief Tell the farmer that a job is finished and how fast it was hashed
+ *
+ * @param covered The amount of candidates the job was responsible for
+ * @param nanoseconds 0 if the job was cancelled
+ * @return false if the report could not be sent
+ */
+static bool send_done(worker_t *worker, uint64_t covered,
+                      uint64_t candidates, uint64_t nanoseconds) {
+    response_t response = {
+        .hash_id = -1,
+        .done = true,
+        .candidates = candidates,
+        .nanoseconds = nanoseconds,
+        .covered = covered,
+    };
+
+    return add_response(worker, &response, true);
+}
+
+static uint64_t elapsed_nanoseconds(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)(now.tv_sec - since->tv_sec) * 1000000000u +
+           (uint64_t)now.tv_nsec - (uint64_t)since->tv_nsec;
+}
+
+/**
+ * @brief Check if the farmer no longer needs the results of the job, because
+ * its hash or, for multi-target jobs, every hash is already solved
+ */
+static bool job_cancelled(const target_list_t *target_list, const job_t *job) {
+    if (target_list == NULL) {
+        return false;
+    }
+
+    if (job->all_targets) {
+        return target_list_all_solved(target_list);
+    }
+
+    return target_list_is_solved(target_list, job->hash_id);
+}
+
+/**
+ * @brief Start enumerating the candidates of the job from first up to but not
+ * including last
+ */
+static void job_candidates(candidates_t *candidates, const job_t *job,
+                           uint64_t first, uint64_t last) {
+    candidates_init(candidates, job->prefix, job->prefix_length,
+                    job->alphabet_start, job->alphabet_stop, job->max_length);
+    candidates_seek(candidates, first, last - first);
+}
+
+/**
+ * @brief Search part of the range of the job for the single hash in the job,
+ * stopping at the first match
+ */
+static search_status_t search_target(worker_t *worker, md5_plan_t *plan,
+                                     const job_t *job, uint64_t first,
+                                     uint64_t last) {
+    md5_batch_t batch = { .count = 0 };
+    md5_digests_t digests;
+
+    candidates_t candidates;
+    job_candidates(&candidates, job, first, last);
+
+    while (candidates_next_batch(&candidates, &batch)) {
+        uint32_t matches = md5_kernel_search(&worker->kernel, plan, &batch,
+                                             &digests);
+
+        if (matches != 0) {
+            char match[MESSAGE_LENGTH_LIMIT + 1];
+            md5_batch_message(&batch, __builtin_ctz(matches), match);
+
+            if (!send_response(worker, match, job->hash_id)) {
+                return SEARCH_FAILED;
+            }
+
+            return SEARCH_FINISHED;
+        }
+    }
+
+    return SEARCH_CONTINUE;
+}
+
+/**
+ * @brief Search part of the range of the job, checking every candidate
+ * against all targets and sending a response for every match
+ */
+static search_status_t search_all_targets(worker_t *worker, const job_t *job,
+                                          uint64_t first, uint64_t last) {
+    md5_batch_t batch = { .count = 0 };
+    md5_digests_t digests;
+    target_match_t matches[MAX_BATCH_MATCHES];
+
+    candidates_t candidates;
+    job_candidates(&candidates, job, first, last);
+
+    while (candidates_next_batch(&candidates, &batch)) {
+        worker->kernel.hash(&batch, &digests);
+
+        int found = target_table_match(&worker->target_table, &digests,
+                                       batch.count, matches,
+                                       MAX_BATCH_MATCHES);
+
+        for (int i = 0; i < found; i++) {
+            char match[MESSAGE_LENGTH_LIMIT + 1];
+            md5_batch_message(&batch, matches[i].lane, match);
+
+            if (!send_response(worker, match, matches[i].hash_id)) {
+                return SEARCH_FAILED;
+            }
+        }
+    }
+
+    return SEARCH_CONTINUE;
+}
+
+/**
+ * @brief Search the range of the current job, claiming it a piece at a time
+ * from the slot of the worker so that the other threads and idle workers can
+ * take what is left of it. Stops early once the job is cancelled or solved.
+ */
+static void search_job(worker_t *worker) {
+    const job_t *job = &worker->job;
+
+    md5_target_t target;
+    md5_plan_t plan;
+
+    if (!job->all_targets) {
+        target = md5_target(job->hash);
+        md5_plan_reset(&plan, &target);
+    }
+
+    uint64_t first, last;
+    search_status_t status = SEARCH_CONTINUE;
+
+    while (status == SEARCH_CONTINUE &&
+           range_claim(worker->range_slot, CLAIM_SIZE, &first, &last)) {
+        if (job_cancelled(worker->target_list, job)) {
+            fprintf(stderr, "%d: Cancelled job '%.*s' 0x%016lx\n",
+                    getpid(), job->prefix_length, job->prefix,
+                    HI(job->hash));
+
+            stats_add(&worker->stats->cancelled, 1);
+
+            status = SEARCH_FINISHED;
+            break;
+        }
+
+        if (job->all_targets) {
+            status = search_all_targets(worker, job, first, last);
+        } else {
+            status = search_target(worker, &plan, job, first, last);
+        }
+
+        atomic_fetch_add_explicit(&worker->hashed, last - first,
+                                  memory_order_relaxed);
+        stats_add(&worker->stats->candidates, last - first);
+    }
+
+    if (status != SEARCH_CONTINUE) {
+        // Keep the other threads from claiming the rest of the range
+        uint64_t end = range_retire(worker->range_slot);
+
+        if (end != 0) {
+            atomic_store(&worker->retired_end, end);
+        }
+
+        atomic_store(&worker->stopped, true);
+    }
+
+    if (status == SEARCH_FAILED) {
+        atomic_store(&worker->failed, true);
+    }
+}
+
+/**
+ * @brief The hashing threads besides the main thread, which help search every
+ * job until the shutdown job
+ */
+static void *hashing_thread(void *argument) {
+    worker_t *worker = argument;
+
+    while (true) {
+        pthread_barrier_wait(&worker->job_barrier);
+
+        if (worker->job.shutdown) {
+            return NULL;
+        }
+
+        search_job(worker);
+
+        pthread_barrier_wait(&worker->job_barrier);
+    }
+}
+
+/**
+ * @brief Search the range of the job with all hashing threads and report how
+ * fast it went to the farmer
+ *
+ * @return false if the job could not be searched or a match not be sent
+ */
+static bool run_job(worker_t *worker, const job_t *job) {
+    fprintf(stderr, "%d: Running job '%.*s' [%lu, %lu) 0x%016lx\n",
+            getpid(), job->prefix_length, job->prefix, job->start, job->end,
+            HI(job->hash));
+
+    if (job->max_length > MESSAGE_LENGTH_LIMIT ||
+        job->prefix_length > job->max_length) {
+        fprintf(stderr, "%d: Received a job for messages longer than %d "
+                        "chars\n",
+                getpid(), MESSAGE_LENGTH_LIMIT);
+
+        return false;
+    }
+
+    if (job->all_targets) {
+        if (worker->target_list == NULL) {
+            fprintf(stderr, "%d: Received a multi-target job without "
+                            "a target list\n",
+                    getpid());
+
+            return false;
+        }
+
+        uint32_t generation = target_list_generation(worker->target_list);
+
+        if (!worker->target_table_built ||
+            worker->target_table_generation != generation) {
+            if (worker->target_table_built) {
+                target_table_free(&worker->target_table);
+                worker->target_table_built = false;
+            }
+
+            if (!target_table_build(&worker->target_table,
+                                    worker->target_list)) {
+                fprintf(stderr, "%d: Failed to build the target table\n",
+                        getpid());
+
+                return false;
+            }
+
+            worker->target_table_built = true;
+            worker->target_table_generation = generation;
+        }
+    }
+
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    atomic_store_explicit(&worker->stats->busy, 1, memory_order_relaxed);
+
+    worker->job = *job;
+    atomic_store(&worker->hashed, 0);
+    atomic_store(&worker->stopped, false);
+    atomic_store(&worker->retired_end, 0);
+    range_publish(worker->range_slot, job);
+
+    // Let the hashing threads join in and wait for all of them to run out of
+    // candidates to claim
+    pthread_barrier_wait(&worker->job_barrier);
+    search_job(worker);
+    pthread_barrier_wait(&worker->job_barrier);
+
+    atomic_store_explicit(&worker->stats->busy, 0, memory_order_relaxed);
+    stats_add(&worker->stats->jobs, 1);
+
+    // Idle workers may have stolen the end of the range, which they report
+    // themselves
+    uint64_t end = range_retire(worker->range_slot);
+
+    if (end == 0) {
+        end = atomic_load(&worker->retired_end);
+    }
+
+    if (atomic_load(&worker->failed)) {
+        return false;
+    }
+
+    // Only whole ranges tell how fast the worker hashes
+    bool stopped = atomic_load(&worker->stopped);
+
+    if (!send_done(worker, end - job->start, atomic_load(&worker->hashed),
+                   stopped ? 0 : elapsed_nanoseconds(&started))) {
+        return false;
+    }
+
+    return flush_responses(worker);
+}
+
+/**
+ * @brief Take the next job from the last message of the farmer, or from the
+ * job queue, or when the queue is empty, steal part of the range of another
+ * worker. Only waits for the queue when there is nothing worth stealing.
+ *
+ * @param stolen Set if the job was stolen
+ * @return false if the job queue could not be read
+ */
+static bool next_job(worker_t *worker, job_t *job, bool *stolen) {
+    *stolen = false;
+
+    if (worker->next_job < worker->jobs.count) {
+        *job = worker->jobs.jobs[worker->next_job++];
+
+        return true;
+    }
+
+    ssize_t receive_status = queue_try_receive(&worker->job_queue,
+                                               &worker->jobs);
+
+    if (receive_status == -1 && errno == EAGAIN) {
+        if (worker->range_board != NULL &&
+            range_steal(worker->range_board, worker->range_slot_index,
+                        STEAL_MIN_SIZE, job)) {
+            *stolen = true;
+
+            return true;
+        }
+
+        receive_status = queue_receive(&worker->job_queue, &worker->jobs);
+    }
+
+    if (receive_status == -1) {
+        fprintf(stderr, "%d: Failed to receive message: %s\n",
+                getpid(), strerror(errno));
+
+        return false;
+    }
+
+    *job = worker->jobs.jobs[0];
+    worker->next_job = 1;
+
+    return true;
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
+    char *target_list_name = NULL;
+    char *range_board_name = NULL;
+    char *stats_board_name = NULL;
+    int range_slot_index = -1;
+    int thread_count = 1;
+    queue_backend_t queue_backend = QUEUE_MQ;
+    // Delay every job from the farmer by a random amount, benchmarks turn
+    // this off
+    bool delay_jobs = true;
+
+    int option;
+    while ((option = getopt(argc, argv, "st:r:S:w:j:R")) != -1) {
+        switch (option) {
+            case 's':
+                queue_backend = QUEUE_SHM;
+                break;
+            case 't':
+                target_list_name = optarg;
+                break;
+            case 'r':
+                range_board_name = optarg;
+                break;
+            case 'S':
+                stats_board_name = optarg;
+                break;
+            case 'w':
+                range_slot_index = (int)strtol(optarg, NULL, 10);
+                break;
+            case 'j':
+                thread_count = (int)strtol(optarg, NULL, 10);
+                break;
+            case 'R':
+                delay_jobs = false;
+                break;
+            default:
+                fprintf(stderr, "%s: invalid arguments\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind != 2 || thread_count < 1 ||
+        ((range_board_name != NULL || stats_board_name != NULL) &&
+         range_slot_index < 0)) {
         fprintf(stderr, "%s: invalid arguments\n", argv[0]);
         return 1;
     }
 
-    char *job_queue_name = argv[1];
-    char *response_queue_name = argv[2];
+    char *job_queue_name = argv[optind];
+    char *response_queue_name = argv[optind + 1];
 
     // fprintf(stderr, "%s:%s\n", job_queue_name, response_queue_name);
 
-    mqd_t job_queue = mq_open(job_queue_name, O_RDONLY);
+    worker_t worker = { .range_slot_index = range_slot_index };
 
-    if (job_queue == -1) {
+    int job_open = queue_open(&worker.job_queue, queue_backend,
+                              job_queue_name, sizeof(job_batch_t), O_RDONLY);
+
+    if (job_open == -1) {
         fprintf(stderr, "%d: Failed to open %s: %s\n",
                 getpid(), job_queue_name, strerror(errno));
 
         return 1;
     }
 
-    mqd_t response_queue = mq_open(response_queue_name, O_WRONLY);
+    int response_open = queue_open(&worker.response_queue, queue_backend,
+                                   response_queue_name,
+                                   sizeof(response_batch_t), O_WRONLY);
 
-    if (response_queue == -1) {
+    if (response_open == -1) {
         fprintf(stderr, "%d: Failed to open %s: %s\n",
                 getpid(), response_queue_name, strerror(errno));
 
         return 1;
     }
 
-    while (true) {
-        job_t job;
-        ssize_t receive_status = mq_receive(job_queue, (char *)&job,
-                                            sizeof(job_t), NULL);
+    // Pack more responses into a message the fewer messages the response
+    // queue holds
+    long response_depth = queue_capacity(&worker.response_queue);
+
+    if (response_depth == -1) {
+        fprintf(stderr, "%d: Failed to get the depth of %s: %s\n",
+                getpid(), response_queue_name, strerror(errno));
 
-        if (receive_status == -1) {
-            fprintf(stderr, "%d: Failed to receive message: %s\n",
-                    getpid(), strerror(errno));
+        return 1;
+    }
+
+    worker.response_batch_size = batch_size(response_depth,
+                                            RESPONSES_IN_FLIGHT,
+                                            RESPONSE_BATCH_MAX);
+    pthread_mutex_init(&worker.responses_lock, NULL);
+
+    worker.kernel = md5_kernel_select();
+    fprintf(stderr, "%d: Using the %s md5 kernel\n",
+            getpid(), worker.kernel.name);
+
+    if (target_list_name != NULL) {
+        worker.target_list = target_list_open(target_list_name);
+
+        if (worker.target_list == NULL) {
+            fprintf(stderr, "%d: Failed to open %s: %s\n",
+                    getpid(), target_list_name, strerror(errno));
 
             return 1;
         }
+    }
 
-        // If the char is a null char, that means the program is finished
-        if (job.starting_char == '\0') {
-            fprintf(stderr, "%d: Exiting\n", getpid());
+    // Without a board the range of a job is only claimed by this worker
+    range_slot_t own_slot;
+    range_slot_init(&own_slot);
+    worker.range_slot = &own_slot;
 
-            // Close handles to both queues
-            mq_close(job_queue);
-            mq_close(response_queue);
-            return 0;
+    if (range_board_name != NULL) {
+        worker.range_board = range_board_open(range_board_name);
+
+        if (worker.range_board == NULL) {
+            fprintf(stderr, "%d: Failed to open %s: %s\n",
+                    getpid(), range_board_name, strerror(errno));
+
+            return 1;
+        }
+
+        if (range_slot_index >= worker.range_board->count) {
+            fprintf(stderr, "%d: No slot %d on the range board\n",
+                    getpid(), range_slot_index);
+
+            return 1;
+        }
+
+        worker.range_slot = &worker.range_board->slots[range_slot_index];
+    }
+
+    // Without a board the counters are kept, but nobody reads them
+    worker_stats_t own_stats = { .candidates = 0 };
+    worker.stats = &own_stats;
+
+    if (stats_board_name != NULL) {
+        worker.stats_board = stats_board_open(stats_board_name);
+
+        if (worker.stats_board == NULL) {
+            fprintf(stderr, "%d: Failed to open %s: %s\n",
+                    getpid(), stats_board_name, strerror(errno));
+
+            return 1;
+        }
+
+        if (range_slot_index >= worker.stats_board->count) {
+            fprintf(stderr, "%d: No slot %d on the stats board\n",
+                    getpid(), range_slot_index);
+
+            return 1;
         }
 
-        fprintf(stderr, "%d: Received job %c 0x%016lx\n",
-                getpid(), job.starting_char,
-                HI(job.hash));
+        worker.stats = &worker.stats_board->workers[range_slot_index];
+    }
+
+    atomic_store(&worker.stats->pid, getpid());
 
-        rsleep(10000);
+    // The main thread takes the jobs and hashes as well, so it is the last
+    // thread of the pool
+    pthread_t threads[thread_count];
+    pthread_barrier_init(&worker.job_barrier, NULL, thread_count);
 
-        // TODO: DO THE WORK
-        char match[MAX_MESSAGE_LENGTH + 1] = {
-            job.starting_char, '\0'
-        };
-        bool success = false;
+    for (int i = 0; i < thread_count - 1; i++) {
+        int create_status = pthread_create(&threads[i], NULL, hashing_thread,
+                                           &worker);
 
-        int alphabet_length = (job.alphabet_stop - job.alphabet_start + 1);
+        if (create_status != 0) {
+            fprintf(stderr, "%d: Failed to create hashing thread: %s\n",
+                    getpid(), strerror(create_status));
 
-        int possibilities = alphabet_length;
-        for (int i = 1; i < MAX_MESSAGE_LENGTH; i++) {
-            possibilities *= alphabet_length;
+            return 1;
         }
+    }
 
-        for (int i = 0; i < possibilities; i++) {
-            // Carry the increment
-            for (int position = 2;
-                 position < MAX_MESSAGE_LENGTH && match[position - 1] != '\0';
-                 position++) {
-                // If the previous char overflowed
-                if (match[position - 1] > job.alphabet_stop) {
-                    // Add one to this char or set it to the first one depending
-                    // on if it already exists or not
-                    if (match[position] == '\0') {
-                        match[position] = job.alphabet_start;
-                    } else {
-                        match[position]++;
-                    }
+    while (true) {
+        job_t job;
+        bool stolen;
 
-                    // Set the previous char back to the start
-                    match[position - 1] = job.alphabet_start;
-                }
+        struct timespec waiting;
+        clock_gettime(CLOCK_MONOTONIC, &waiting);
+
+        if (!next_job(&worker, &job, &stolen)) {
+            return 1;
+        }
+
+        stats_add(&worker.stats->idle_nanoseconds,
+                  elapsed_nanoseconds(&waiting));
+
+        if (job.shutdown) {
+            fprintf(stderr, "%d: Exiting\n", getpid());
+
+            // Release the hashing threads to see the shutdown job
+            worker.job = job;
+            pthread_barrier_wait(&worker.job_barrier);
+
+            for (int i = 0; i < thread_count - 1; i++) {
+                pthread_join(threads[i], NULL);
             }
 
-            // printf("%s: %d\n", match, possibilities);
+            pthread_barrier_destroy(&worker.job_barrier);
+            pthread_mutex_destroy(&worker.responses_lock);
 
-            // Hash the mesage
-            uint128_t new_hash = md5s(match, strlen(match));
+            if (worker.target_table_built) {
+                target_table_free(&worker.target_table);
+            }
 
-            if (new_hash == job.hash) {
-                success = true;
-                break;
+            if (worker.target_list != NULL) {
+                target_list_close(worker.target_list);
+            }
+
+            if (worker.range_board != NULL) {
+                range_board_close(worker.range_board);
             }
 
-            // Increment the second char
-            match[1]++;
+            if (worker.stats_board != NULL) {
+                stats_board_close(worker.stats_board);
+            }
+
+            // Close handles to both queues
+            queue_close(&worker.job_queue);
+            queue_close(&worker.response_queue);
+            return 0;
         }
 
-        // Only send the message if it succeeded
-        if (success) {
-            response_t response;
-            strncpy(response.match, match, MAX_MESSAGE_LENGTH + 1);
-            response.hash_id = job.hash_id;
-            ssize_t send_status = mq_send(response_queue, (char *)&response,
-                                          sizeof(response_t), 0);
+        fprintf(stderr, "%d: %s job '%.*s' 0x%016lx\n",
+                getpid(), stolen ? "Stole" : "Received",
+                job.prefix_length, job.prefix, HI(job.hash));
 
-            if (send_status == -1) {
-                fprintf(stderr, "%d: Failed to send message: %s\n",
-                        getpid(), strerror(errno));
+        // Skip jobs that were queued before their hash got solved
+        if (job_cancelled(worker.target_list, &job)) {
+            fprintf(stderr, "%d: Skipped job '%.*s' 0x%016lx\n",
+                    getpid(), job.prefix_length, job.prefix, HI(job.hash));
 
+            stats_add(&worker.stats->cancelled, 1);
+
+            if (!send_done(&worker, job.end - job.start, 0, 0) ||
+                !flush_responses(&worker)) {
                 return 1;
             }
+
+            continue;
+        }
+
+        // Only jobs from the farmer are delayed, a stolen job was already
+        // delayed by the worker it was stolen from
+        if (!stolen && delay_jobs) {
+            rsleep(10000);
+        }
+
+        if (!run_job(&worker, &job)) {
+            return 1;
         }
     }
 
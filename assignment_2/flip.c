@@ -12,10 +12,15 @@
  */
 
 #include <errno.h> // for perror()
+#include <immintrin.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 // For testing purposes only
 // #include <math.h>
@@ -35,11 +40,41 @@
 // clear bit n in v
 #define BIT_CLEAR(v, n) ((v) = (v) & ~BITMASK(n))
 
+// The algorithms that can flip the pieces, pick one by defining
+// FLIP_ALGORITHM when compiling
+#define FLIP_MUTEX 0 // Every toggle locks the 128 bit chunk of its piece
+#define FLIP_ATOMIC 1 // Toggles are atomic XORs on 64 bit words, no locks
+#define FLIP_BLOCKED 2 // Every thread owns a part of the board and applies
+                       // all multiples to it, a cache sized block at a time
+
+#ifndef FLIP_ALGORITHM
+#define FLIP_ALGORITHM FLIP_MUTEX
+#endif
+
+// The amount of pieces a thread should toggle for every run of multiples it
+// takes, so that the large multiples, which only toggle a few pieces each,
+// are handed out many at a time
+#define CLAIM_TOGGLES 65536
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "the board is addressed as 64 bit words, which needs little endian"
+#endif
+
+// The board as 64 bit words: piece n is bit n % 64 of word n / 64, which on
+// a little endian CPU is the same bit as in the 128 bit chunks
+typedef uint64_t word_t __attribute__((may_alias));
+#define words ((word_t *)buffer)
+
+#define WORD_COUNT ((int64_t)((NROF_PIECES / 128) + 1) * 2)
+
+#if FLIP_ALGORITHM == FLIP_MUTEX
+
 static pthread_mutex_t mutexes[(NROF_PIECES / 128) + 1];
 
-static void *thread(void *arg) {
-    int multiple = *((int *)arg);
-    free(arg);
+// Sweeps always begin at the first piece, the locks are taken one at a time so
+// where a thread starts does not matter
+static void flip_multiple(int multiple, int64_t start) {
+    (void)start;
 
     for (int current_piece = multiple; current_piece <= NROF_PIECES;
          current_piece += multiple) {
@@ -60,10 +95,432 @@ static void *thread(void *arg) {
 
         pthread_mutex_unlock(&mutexes[index]);
     }
+}
+
+#elif FLIP_ALGORITHM == FLIP_ATOMIC
+
+/**
+ * @brief Toggle the pieces of a multiple from first up to but not including
+ * last, where first is at least 1
+ */
+static void flip_range(int multiple, int64_t first, int64_t last) {
+    // Gather the toggles that fall in the same word and flip them with a
+    // single XOR, so that a thread writes every word at most once instead of
+    // once for every piece in it
+    int64_t current_piece = (first + multiple - 1) / multiple * multiple;
+    int64_t index = current_piece / 64;
+    uint64_t toggles = 0;
+
+    for (; current_piece < last; current_piece += multiple) {
+        if (current_piece / 64 != index) {
+            __atomic_fetch_xor(&words[index], toggles, __ATOMIC_RELAXED);
+
+            index = current_piece / 64;
+            toggles = 0;
+        }
+
+        toggles |= (uint64_t)1 << (current_piece % 64);
+    }
+
+    // Waiting on the flipped barrier orders these XORs before any thread
+    // looks for the black pieces
+    if (toggles != 0) {
+        __atomic_fetch_xor(&words[index], toggles, __ATOMIC_RELAXED);
+    }
+}
+
+// Sweep from start to the end of the board, then wrap around to its start
+static void flip_multiple(int multiple, int64_t start) {
+    flip_range(multiple, start, (int64_t)NROF_PIECES + 1);
+    flip_range(multiple, 1, start);
+}
+
+#elif FLIP_ALGORITHM == FLIP_BLOCKED
+
+// The amount of words a thread flips at a time, small enough to stay in the
+// L1 cache while every multiple is applied to them
+#define BLOCK_WORDS 2048
+#define BLOCK_PIECES (BLOCK_WORDS * 64)
+
+// The amount of words on a cache line, which always go to the same thread
+#define LINE_WORDS 8
+
+// The multiples up to this one toggle whole words at a time with a periodic
+// mask instead of one piece at a time
+#define PERIODIC_MAX 64
+
+// A multiple m toggles the same pieces of word w as of word w + m / gcd(m,
+// 64). The period of a row is made at least 4 words by repeating it, so that
+// 4 words of mask can be taken at a time, and the row gets 3 more words to
+// read past the end of the period without wrapping.
+#define PERIODIC_ROW (PERIODIC_MAX + 3)
+
+static uint64_t periodic_masks[PERIODIC_MAX + 1][PERIODIC_ROW];
+static int periodic_periods[PERIODIC_MAX + 1];
+
+static void periodic_masks_init(void) {
+    for (int multiple = 2; multiple <= PERIODIC_MAX; multiple++) {
+        // Dividing by gcd(multiple, 64) drops the factors of two
+        int period = multiple >> __builtin_ctz(multiple);
+
+        while (period < 4) {
+            period *= 2;
+        }
+
+        periodic_periods[multiple] = period;
+
+        for (int word = 0; word < period + 3; word++) {
+            uint64_t mask = 0;
+
+            for (int bit = 0; bit < 64; bit++) {
+                if ((word * 64 + bit) % multiple == 0) {
+                    mask |= (uint64_t)1 << bit;
+                }
+            }
+
+            periodic_masks[multiple][word] = mask;
+        }
+    }
+}
+
+/**
+ * @brief XOR the words with the periodic mask of a multiple, starting at the
+ * given phase of its period
+ */
+typedef void (*xor_periodic_fn)(word_t *word, int64_t count, int multiple,
+                                int phase);
+
+static void xor_periodic_scalar(word_t *word, int64_t count, int multiple,
+                                int phase) {
+    const uint64_t *masks = periodic_masks[multiple];
+    int period = periodic_periods[multiple];
+
+    for (int64_t i = 0; i < count; i++) {
+        word[i] ^= masks[phase];
+
+        if (++phase == period) {
+            phase = 0;
+        }
+    }
+}
+
+__attribute__((target("avx2"))) static void
+xor_periodic_avx2(word_t *word, int64_t count, int multiple, int phase) {
+    const uint64_t *masks = periodic_masks[multiple];
+    int period = periodic_periods[multiple];
+    int64_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m256i mask = _mm256_loadu_si256((const __m256i *)(masks + phase));
+        __m256i value = _mm256_loadu_si256((const __m256i *)(word + i));
+
+        _mm256_storeu_si256((__m256i *)(word + i),
+                            _mm256_xor_si256(value, mask));
+
+        phase += 4;
+        if (phase >= period) {
+            phase -= period;
+        }
+    }
+
+    xor_periodic_scalar(word + i, count - i, multiple, phase);
+}
+
+static xor_periodic_fn xor_periodic = xor_periodic_scalar;
+
+static void toggle(int64_t piece) {
+    words[piece / 64] ^= (uint64_t)1 << (piece % 64);
+}
+
+/**
+ * @brief Toggle the pieces from first up to but not including last as many
+ * times as they have divisors from 2 to NROF_PIECES. first starts a word. The
+ * multiples up to PERIODIC_MAX XOR every word with their periodic mask, which
+ * also toggles piece 0 and the pieces past NROF_PIECES that are never
+ * printed. The first hit of every multiple up to BLOCK_PIECES is computed and
+ * then strided to. The larger multiples hit the block at most once, so they
+ * are applied by quotient instead: the pieces that are quotient times such a
+ * multiple are a stride of quotient.
+ */
+static void flip_block(int64_t first, int64_t last) {
+    int64_t first_word = first / 64;
+    int64_t word_count = (last + 63) / 64 - first_word;
+
+    for (int multiple = 2; multiple <= PERIODIC_MAX && multiple < last;
+         multiple++) {
+        xor_periodic(&words[first_word], word_count, multiple,
+                     first_word % periodic_periods[multiple]);
+    }
+
+    for (int64_t multiple = PERIODIC_MAX + 1;
+         multiple <= BLOCK_PIECES && multiple < last; multiple++) {
+        int64_t piece = (first + multiple - 1) / multiple * multiple;
+
+        if (piece < multiple) {
+            piece = multiple;
+        }
+
+        for (; piece < last; piece += multiple) {
+            toggle(piece);
+        }
+    }
+
+    for (int64_t quotient = 1; quotient * (BLOCK_PIECES + 1) < last;
+         quotient++) {
+        int64_t multiple = (first + quotient - 1) / quotient;
+
+        if (multiple <= BLOCK_PIECES) {
+            multiple = BLOCK_PIECES + 1;
+        }
+
+        for (int64_t piece = quotient * multiple; piece < last;
+             piece += quotient) {
+            toggle(piece);
+        }
+    }
+}
+
+// Every thread flips its own part of the board, no other thread writes to it
+static void flip(int index) {
+    // Cut the board into equal parts on cache line boundaries, so that no
+    // two threads write to the same line. buffer need not start on one.
+    int64_t skew = (int64_t)((uintptr_t)words / sizeof(uint64_t)) %
+                   LINE_WORDS;
+    int64_t lines = (WORD_COUNT + skew + LINE_WORDS - 1) / LINE_WORDS;
+
+    int64_t first_word = lines * index / NROF_THREADS * LINE_WORDS - skew;
+    int64_t last_word = lines * (index + 1) / NROF_THREADS * LINE_WORDS - skew;
+
+    int64_t first = first_word < 0 ? 0 : first_word * 64;
+    int64_t last = last_word * 64;
+
+    if (last > (int64_t)NROF_PIECES + 1) {
+        last = (int64_t)NROF_PIECES + 1;
+    }
+
+    for (int64_t block = first; block < last; block += BLOCK_PIECES) {
+        flip_block(block,
+                   last - block < BLOCK_PIECES ? last : block + BLOCK_PIECES);
+    }
+}
+
+#else
+#error "unknown FLIP_ALGORITHM"
+#endif
+
+#if FLIP_ALGORITHM == FLIP_MUTEX || FLIP_ALGORITHM == FLIP_ATOMIC
+
+// The first multiple that no thread took yet
+static atomic_int next_multiple = 2;
+
+/**
+ * @brief Take the next run of multiples, from first up to but not including
+ * last. A run starting at multiple m toggles about NROF_PIECES / m pieces for
+ * every multiple in it, so runs get longer as the multiples grow.
+ *
+ * @return false once every multiple was taken
+ */
+static bool claim_multiples(int *first, int *last) {
+    int multiple = atomic_load_explicit(&next_multiple, memory_order_relaxed);
+    int end;
+
+    do {
+        if (multiple > NROF_PIECES) {
+            return false;
+        }
+
+        int64_t count = (int64_t)multiple * CLAIM_TOGGLES / NROF_PIECES;
+
+        if (count < 1) {
+            count = 1;
+        }
+
+        end = count > NROF_PIECES + 1 - multiple ? NROF_PIECES + 1
+                                                 : multiple + (int)count;
+    } while (!atomic_compare_exchange_weak_explicit(
+        &next_multiple, &multiple, end, memory_order_relaxed,
+        memory_order_relaxed));
+
+    *first = multiple;
+    *last = end;
+
+    return true;
+}
+
+// The amount of words on a cache line
+#define LINE_WORDS 8
+
+/**
+ * @brief The piece a thread starts every sweep over the board at. Every
+ * multiple spans the whole board, so threads cannot own cache lines. Instead
+ * every thread starts in its own part of the board, cut on cache line
+ * boundaries, and wraps around, so that threads flipping small multiples at
+ * the same time are on different lines instead of chasing each other over the
+ * same ones.
+ */
+static int64_t sweep_start(int index) {
+    int64_t skew = (int64_t)((uintptr_t)words / sizeof(uint64_t)) %
+                   LINE_WORDS;
+    int64_t lines = (WORD_COUNT + skew + LINE_WORDS - 1) / LINE_WORDS;
+    int64_t start = (lines * index / NROF_THREADS * LINE_WORDS - skew) * 64;
+
+    if (start < 1) {
+        return 1;
+    }
+
+    return start > (int64_t)NROF_PIECES + 1 ? (int64_t)NROF_PIECES + 1 : start;
+}
+
+// Every thread flips runs of multiples until they are all taken
+static void flip(int index) {
+    int64_t start = sweep_start(index);
+    int first, last;
+
+    while (claim_multiples(&first, &last)) {
+        for (int multiple = first; multiple < last; multiple++) {
+            flip_multiple(multiple, start);
+        }
+    }
+}
+
+#endif
+
+// The black pieces found by every thread, written out in thread order
+typedef struct {
+    char *text; // NULL if it could not be allocated
+    size_t length;
+} output_t;
+
+static output_t outputs[NROF_THREADS];
+
+// Every piece is flipped before any thread looks for the black ones
+static pthread_barrier_t flipped;
+
+// The decimal digits of every number from 0 to 99
+static const char digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233"
+    "34353637383940414243444546474849505152535455565758596061626364656667"
+    "6869707172737475767778798081828384858687888990919293949596979899";
+
+/**
+ * @brief Write the piece in decimal followed by a newline
+ *
+ * @return Where the next piece goes
+ */
+static char *format_piece(char *text, uint64_t piece) {
+    int length = 1;
+    for (uint64_t rest = piece; rest >= 10; rest /= 10) {
+        length++;
+    }
+
+    // Fill in the digits from the back, two at a time
+    char *digit = text + length;
+
+    while (piece >= 100) {
+        digit -= 2;
+        memcpy(digit, &digit_pairs[piece % 100 * 2], 2);
+        piece /= 100;
+    }
+
+    if (piece >= 10) {
+        digit -= 2;
+        memcpy(digit, &digit_pairs[piece * 2], 2);
+    } else {
+        digit[-1] = (char)('0' + piece);
+    }
+
+    text[length] = '\n';
+
+    return text + length + 1;
+}
+
+/**
+ * @brief Write every black piece of a part of the board to the output of the
+ * thread. The words are scanned for set bits, which are counted first to
+ * size the text.
+ */
+static void format_pieces(int index, output_t *output) {
+    int64_t first_word = WORD_COUNT * index / NROF_THREADS;
+    int64_t last_word = WORD_COUNT * (index + 1) / NROF_THREADS;
+
+    // The word holding NROF_PIECES also holds pieces past the board
+    int64_t end_word = NROF_PIECES / 64;
+    uint64_t end_mask = ~(uint64_t)0 >> (63 - NROF_PIECES % 64);
+
+    if (last_word > end_word + 1) {
+        last_word = end_word + 1;
+    }
+
+    size_t count = 0;
+    for (int64_t word = first_word; word < last_word; word++) {
+        count += __builtin_popcountll(words[word]);
+    }
+
+    // At most 20 digits and a newline for every piece
+    output->text = malloc(count * 21 + 1);
+    output->length = 0;
+
+    if (output->text == NULL) {
+        return;
+    }
+
+    char *text = output->text;
+
+    for (int64_t word = first_word; word < last_word; word++) {
+        uint64_t bits = words[word];
+
+        // Piece 0 is not on the board
+        if (word == 0) {
+            bits &= ~(uint64_t)1;
+        }
+
+        if (word == end_word) {
+            bits &= end_mask;
+        }
+
+        while (bits != 0) {
+            text = format_piece(text, word * 64 + __builtin_ctzll(bits));
+            bits &= bits - 1;
+        }
+    }
+
+    output->length = text - output->text;
+}
+
+static void *thread(void *arg) {
+    int index = (int)(intptr_t)arg;
+
+    flip(index);
+
+    pthread_barrier_wait(&flipped);
+
+    format_pieces(index, &outputs[index]);
 
     return NULL;
 }
 
+/**
+ * @return false if the text could not be written in full
+ */
+static bool write_all(int fd, const char *text, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, text, length);
+
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return false;
+        }
+
+        text += written;
+        length -= written;
+    }
+
+    return true;
+}
+
 uint64_t micros() {
     struct timespec now;
     timespec_get(&now, TIME_UTC);
@@ -73,71 +530,60 @@ uint64_t micros() {
 int main(void) {
     uint64_t start = micros();
 
+#if FLIP_ALGORITHM == FLIP_MUTEX
     for (int i = 0; i < sizeof(mutexes) / sizeof(pthread_mutex_t); i++) {
         pthread_mutex_init(&mutexes[i], NULL);
     }
+#elif FLIP_ALGORITHM == FLIP_BLOCKED
+    periodic_masks_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        xor_periodic = xor_periodic_avx2;
+    }
+#endif
 
     pthread_t thread_ids[NROF_THREADS] = { 0 };
+    pthread_barrier_init(&flipped, NULL, NROF_THREADS);
 
     // Set all pieces black
     for (int chunk = 0; chunk < (NROF_PIECES / 128) + 1; chunk++) {
         buffer[chunk] = ~0;
     }
 
-    // This will spawn threads
-    int thread_index = 0;
-
-    for (int multiple = 2; multiple <= NROF_PIECES; multiple++) {
-        pthread_t *thread_id = &thread_ids[thread_index];
-
-        // Check if thread exists
-        if (*thread_id != 0) {
-            // Wait on the thread
-            pthread_join(*thread_id, NULL);
-        }
+    // Start the threads, which take the multiples from 2 to NROF_PIECES
+    // between them, or each flip their own part of the board, and then each
+    // find the black pieces of a part of the board
+    for (int i = 0; i < NROF_THREADS; i++) {
+        int create_status = pthread_create(&thread_ids[i], NULL, thread,
+                                           (void *)(intptr_t)i);
 
-        // Setup the argument(s) to the thread
-        int *multiple_arg = malloc(sizeof(int));
-        if (multiple_arg == NULL) {
-            perror("unable to allocate memory for thread arguments");
+        if (create_status != 0) {
+            errno = create_status;
+            perror("unable to create thread");
             return 1;
         }
-        *multiple_arg = multiple;
-
-        // Spawn the thread
-        pthread_create(thread_id, NULL, thread, multiple_arg);
-
-        // Increment the thread_index and wrap it if it is >(NROF_THREADS - 1)
-        thread_index = (thread_index + 1) % NROF_THREADS;
     }
 
-    // Join all remaining threads
+    // Wait for all of the threads
     for (int i = 0; i < NROF_THREADS; i++) {
-        pthread_t *thread_id = &thread_ids[i];
-
-        // Check if thread exists
-        if (*thread_id != 0) {
-            // Wait on the thread
-            pthread_join(*thread_id, NULL);
-            *thread_id = 0;
-        }
+        pthread_join(thread_ids[i], NULL);
     }
 
-    // Unnecessary to lock mutex since the code is single threaded at this point
-
-    // Print all the items black
-    for (int piece = 1; piece <= NROF_PIECES; piece++) {
-        int bit = piece % 128;
-        int index = piece / 128;
+    pthread_barrier_destroy(&flipped);
 
-        uint128_t chunk = buffer[index];
-
-        if (BIT_IS_SET(chunk, bit)) {
-            // double square_root = sqrt((double)piece);
-            // bool perfect_square = floorf(square_root) == square_root;
+    // Print all the items black, in the order of the parts of the threads
+    for (int i = 0; i < NROF_THREADS; i++) {
+        if (outputs[i].text == NULL) {
+            perror("unable to allocate memory for the output");
+            return 1;
+        }
 
-            printf("%d\n", piece);
+        if (!write_all(STDOUT_FILENO, outputs[i].text, outputs[i].length)) {
+            perror("unable to write the output");
+            return 1;
         }
+
+        free(outputs[i].text);
     }
 
     uint64_t end = micros();